@@ -0,0 +1,90 @@
+#include "weft.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define len(arr) (int)(sizeof(arr) / sizeof(*arr))
+
+typedef weft_Builder Builder;
+typedef weft_Program Program;
+typedef weft_V32     V32;
+typedef weft_V64     V64;
+
+enum { N = 1<<16, LOOPS = 100 };
+
+static double now(void) {
+    return (double)clock() / CLOCKS_PER_SEC;
+}
+
+static V32 pow_f32(Builder* b, V32 x) { return weft_pow_f32(b, x, weft_uniform_32(b,2)); }
+static V64 pow_f64(Builder* b, V64 x) { return weft_pow_f64(b, x, weft_uniform_64(b,2)); }
+
+static float  powf_half(float  x) { return powf(x, 0.5f); }
+static double pow_half (double x) { return pow (x, 0.5 ); }
+
+#define BENCH(B,F)                                                                         \
+    static void bench##B(const char* name, V##B (*fn)(Builder*, V##B), F (*libm)(F),          \
+                         F* dst, F* src) {                                                    \
+        Builder* b = weft_builder();                                                          \
+        weft_store_##B(b,0, fn(b, weft_load_##B(b,1)));                                       \
+        Program* p = weft_compile(b);                                                         \
+                                                                                              \
+        F half = (F)0.5;                                                                      \
+        double start = now();                                                                 \
+        for (int loop = 0; loop < LOOPS; loop++) {                                            \
+            weft_run(p, N, (void*[]){dst, src, &half});                                       \
+        }                                                                                     \
+        double const weft = now() - start;                                                    \
+        free(p);                                                                              \
+                                                                                              \
+        start = now();                                                                        \
+        for (int loop = 0; loop < LOOPS; loop++) {                                            \
+            for (int i = 0; i < N; i++) {                                                     \
+                dst[i] = libm(src[i]);                                                        \
+            }                                                                                 \
+        }                                                                                     \
+        double const ref = now() - start;                                                     \
+                                                                                              \
+        printf("%-8s weft %6.2f ns   libm %6.2f ns\n", name, weft * 1e9 / (N*LOOPS)          \
+                                                       , ref  * 1e9 / (N*LOOPS));             \
+    }
+BENCH(32,float)
+BENCH(64,double)
+#undef BENCH
+
+int main(void) {
+    float  *fsrc = malloc(N * sizeof *fsrc), *fdst = malloc(N * sizeof *fdst);
+    double *dsrc = malloc(N * sizeof *dsrc), *ddst = malloc(N * sizeof *ddst);
+    for (int i = 0; i < N; i++) {
+        dsrc[i] = 0.001 + 10.0 * i / N;
+        fsrc[i] = (float)dsrc[i];
+    }
+
+    struct {
+        const char* name;
+        V32   (*weft32)(Builder*, V32);
+        float (*libm32)(float);
+        V64    (*weft64)(Builder*, V64);
+        double (*libm64)(double);
+    } const fns[] = {
+        {"exp", weft_exp_f32, expf,      weft_exp_f64, exp},
+        {"log", weft_log_f32, logf,      weft_log_f64, log},
+        {"sin", weft_sin_f32, sinf,      weft_sin_f64, sin},
+        {"cos", weft_cos_f32, cosf,      weft_cos_f64, cos},
+        {"pow", pow_f32,      powf_half, pow_f64,      pow_half},
+    };
+    for (int i = 0; i < len(fns); i++) {
+        char name[16];
+        snprintf(name, sizeof name, "%s_f32", fns[i].name);
+        bench32(name, fns[i].weft32, fns[i].libm32, fdst, fsrc);
+        snprintf(name, sizeof name, "%s_f64", fns[i].name);
+        bench64(name, fns[i].weft64, fns[i].libm64, ddst, dsrc);
+    }
+
+    free(fsrc);
+    free(fdst);
+    free(dsrc);
+    free(ddst);
+    return 0;
+}
@@ -0,0 +1,150 @@
+#include "weft.h"
+#undef NDEBUG
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Built plain, this writes each kernel below as C with weft_emit_c().  Built with -DEMITTED and
+// linked with that C, it tests the emitted kernels against weft_run().
+
+#define len(arr) (int)(sizeof(arr) / sizeof(*arr))
+
+typedef weft_Builder Builder;
+typedef weft_Program Program;
+typedef weft_V8      V8;
+typedef weft_V16     V16;
+typedef weft_V32     V32;
+typedef weft_V64     V64;
+
+// Each kernel reads ptr[0] and ptr[1], writes ptr[2] through ptr[5], and may use ptr[6] uniformly.
+enum { LEN = 1003, BUFS = 7 };
+
+static V32 splat_f32(Builder* b, float f) {
+    int32_t bits;
+    memcpy(&bits, &f, sizeof bits);
+    return weft_splat_32(b, bits);
+}
+
+static void ints(Builder* b) {
+    V32 X = weft_load_32(b,0),
+        Y = weft_load_32(b,1),
+        s = weft_add_i32(b, X, weft_splat_32(b,7)),
+        m = weft_mul_i32(b, X, Y),
+        r = weft_sel_32(b, weft_lt_s32(b,X,Y), s, m);
+    weft_store_32(b,2, weft_xor_32(b, weft_shr_s32(b, r, weft_splat_32(b,3)),
+                                      weft_shl_i32(b, X, weft_and_32(b, Y, weft_splat_32(b,31)))));
+    weft_store_32(b,3, weft_max_u32(b, weft_abs_s32(b,X), weft_min_s32(b,X,Y)));
+    weft_store_32(b,4, weft_sub_i32(b, weft_uniform_32(b,6), weft_index_32(b)));
+
+    V64 W = weft_widen_s32(b,X);
+    weft_store_64(b,5, weft_add_i64(b, weft_mul_i64(b,W,W), weft_index_64(b)));
+}
+
+static void smalls(Builder* b) {
+    V8 X = weft_load_8(b,0),
+       Y = weft_load_8(b,1);
+    weft_store_8(b,2, weft_max_s8(b, X, weft_sub_i8(b,X,Y)));
+
+    V16 H = weft_widen_u8(b,X);
+    weft_store_16(b,3, weft_shr_u16(b, weft_mul_i16(b,H,H), weft_splat_16(b,2)));
+    weft_store_masked_8(b,4, weft_lt_u8(b,X,Y), Y);
+    weft_store_8(b,5, weft_narrow_i16(b, weft_le_s16(b, weft_widen_s8(b,X), weft_widen_s8(b,Y))));
+}
+
+static void floats(Builder* b) {
+    V32 X = weft_load_32(b,0),
+        Y = weft_load_32(b,1),
+        a = weft_mul_f32(b, X, weft_uniform_32(b,6)),
+        d = weft_div_f32(b, a, weft_add_f32(b, Y, splat_f32(b,1.0f)));
+    weft_store_32(b,2, weft_min_f32(b, weft_sqrt_f32(b, weft_abs_f32(b,d)), weft_floor_f32(b,a)));
+    weft_store_32(b,3, weft_cast_f32(b, weft_round_f32(b, weft_mul_f32(b, X, splat_f32(b,3)))));
+    weft_store_32(b,4, weft_sel_32(b, weft_le_f32(b,X,Y), X, weft_cast_s32(b, weft_load_32(b,1))));
+
+    V64 W = weft_widen_f32(b,X);
+    weft_store_64(b,5, weft_div_f64(b, W, weft_sub_f64(b, W, weft_widen_f32(b,Y))));
+}
+
+#if defined(EMITTED)
+    void ints_emitted  (int64_t, void* const[]);
+    void smalls_emitted(int64_t, void* const[]);
+    void floats_emitted(int64_t, void* const[]);
+    #define KERNEL(name) {#name, name, name##_emitted}
+#else
+    #define KERNEL(name) {#name, name, NULL}
+#endif
+
+static const struct {
+    const char* name;
+    void (*build)(Builder*);
+    void (*emitted)(int64_t, void* const[]);
+} kernels[] = {
+    KERNEL(ints),
+    KERNEL(smalls),
+    KERNEL(floats),
+};
+
+int main(void) {
+#if !defined(EMITTED)
+    for (int k = 0; k < len(kernels); k++) {
+        Builder* b = weft_builder();
+        kernels[k].build(b);
+
+        char name[64];
+        snprintf(name, sizeof name, "%s_emitted", kernels[k].name);
+        assert(weft_emit_c(b, name, stdout));
+        free(weft_compile(b));
+    }
+#else
+    // Integer kernels get random bits.  The float kernel gets small values so casts stay in range.
+    uint64_t bits[2][LEN];
+    float    f32s[2][LEN];
+    uint64_t seed = 1;
+    for (int j = 0; j < 2; j++) {
+        for (int i = 0; i < LEN; i++) {
+            seed = seed * 6364136223846793005u + 1442695040888963407u;
+            bits[j][i] = seed;
+            f32s[j][i] = (float)((int)(seed >> 33) % 2001 - 1000) / 7;
+        }
+    }
+
+    for (int k = 0; k < len(kernels); k++) {
+        Builder* b = weft_builder();
+        kernels[k].build(b);
+        Program* p = weft_compile(b);
+
+        const int ns[] = {0,1,7,8,9,LEN};
+        for (int j = 0; j < len(ns); j++) {
+            const int n = ns[j];
+            uint64_t (*want)[LEN] = calloc(BUFS, sizeof *want),
+                     (*got )[LEN] = calloc(BUFS, sizeof *got );
+            for (int i = 0; i < 2; i++) {
+                if (kernels[k].build == floats) {
+                    memcpy(want[i], f32s[i], sizeof f32s[i]);
+                    memcpy( got[i], f32s[i], sizeof f32s[i]);
+                } else {
+                    memcpy(want[i], bits[i], sizeof bits[i]);
+                    memcpy( got[i], bits[i], sizeof bits[i]);
+                }
+            }
+            want[6][0] = got[6][0] = 0x40400000;  // 3.0f, or 1077936128 as an int
+
+            void* want_ptr[BUFS];
+            void*  got_ptr[BUFS];
+            for (int i = 0; i < BUFS; i++) {
+                want_ptr[i] = want[i];
+                got_ptr [i] =  got[i];
+            }
+            weft_run(p, n, want_ptr);
+            kernels[k].emitted(n, got_ptr);
+            assert(0 == memcmp(want, got, BUFS * sizeof *want));
+
+            free(want);
+            free(got);
+        }
+        free(p);
+    }
+#endif
+    return 0;
+}
@@ -1,6 +1,10 @@
+#if !defined(__wasm__) && !defined(_POSIX_C_SOURCE)
+    #define _POSIX_C_SOURCE 200809L  // For mkstemp() under -std=c99.
+#endif
 #include "weft.h"
 #undef NDEBUG
 #include <assert.h>
+#include <math.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
@@ -9,6 +13,9 @@
 #if defined(__aarch64__)
     #include <sys/mman.h>
 #endif
+#if !defined(__wasm__)
+    #include <unistd.h>
+#endif
 
 #define len(arr) (int)(sizeof(arr) / sizeof(*arr))
 
@@ -146,6 +153,1367 @@ static void test_no_tail(void) {
     free(p);
 }
 
+static int64_t ulps32(float a, float b) {
+    int32_t x,y;
+    memcpy(&x, &a, sizeof x);
+    memcpy(&y, &b, sizeof y);
+    return x > y ? (int64_t)x - y : (int64_t)y - x;
+}
+static int64_t ulps64(double a, double b) {
+    int64_t x,y;
+    memcpy(&x, &a, sizeof x);
+    memcpy(&y, &b, sizeof y);
+    return x > y ? x-y : y-x;
+}
+// Check weft_exp/log/sin/cos against libm over N evenly spaced inputs, within weft.h's bounds.
+static void test_transcendental_accuracy(void) {
+    enum { N = 10000 };
+    float  *fx = malloc(N * sizeof *fx), *fr = malloc(N * sizeof *fr);
+    double *dx = malloc(N * sizeof *dx), *dr = malloc(N * sizeof *dr);
+
+    V32 (*fn32[])(Builder*, V32) = {weft_exp_f32, weft_log_f32, weft_sin_f32, weft_cos_f32};
+    V64 (*fn64[])(Builder*, V64) = {weft_exp_f64, weft_log_f64, weft_sin_f64, weft_cos_f64};
+    double (*libm[])(double) = {exp, log, sin, cos};
+    double lo[] = {-80, 0, -1000, -1000},
+           hi[] = {+80,  100, 1000, 1000};
+    int64_t max_ulp32[] = {1,2,1,1},
+            max_ulp64[] = {1,2,2,2};
+
+    for (int f = 0; f < len(libm); f++) {
+        for (int i = 0; i < N; i++) {
+            dx[i] = lo[f] + (hi[f] - lo[f]) * i / N;
+            fx[i] = (float)dx[i];
+        }
+
+        Builder* b = weft_builder();
+        weft_store_32(b,0, fn32[f](b, weft_load_32(b,1)));
+        weft_store_64(b,2, fn64[f](b, weft_load_64(b,3)));
+        Program* p = weft_compile(b);
+        weft_run(p, N, (void*[]){fr,fx,dr,dx});
+        free(p);
+
+        // libm's double results are themselves only faithful, so allow the f64 bound one more ulp.
+        for (int i = 0; i < N; i++) {
+            assert(ulps32(fr[i], (float)libm[f]((double)fx[i])) <= max_ulp32[f]);
+            assert(ulps64(dr[i],        libm[f](         dx[i])) <= max_ulp64[f] + 1);
+        }
+    }
+
+    // pow over x in [e^-23, e^23] and y in [-20, 20], so |y*log(x)| reaches 460.
+    {
+        float  *fy = malloc(N * sizeof *fy);
+        double *dy = malloc(N * sizeof *dy);
+        for (int i = 0; i < N; i++) {
+            dx[i] = exp(-23 + 46.0 * i / N);
+            dy[i] = -20 + 40.0 * (i * 7919 % N) / N;
+            fx[i] = (float)dx[i];
+            fy[i] = (float)dy[i];
+        }
+        Builder* b = weft_builder();
+        weft_store_32(b,0, weft_pow_f32(b, weft_load_32(b,1), weft_load_32(b,2)));
+        weft_store_64(b,3, weft_pow_f64(b, weft_load_64(b,4), weft_load_64(b,5)));
+        Program* p = weft_compile(b);
+        weft_run(p, N, (void*[]){fr,fx,fy,dr,dx,dy});
+        free(p);
+
+        for (int i = 0; i < N; i++) {
+            assert(ulps32(fr[i], (float)pow((double)fx[i], (double)fy[i])) <= 1);
+            assert(ulps64(dr[i], pow(dx[i], dy[i])) <= 2 + 1);
+        }
+        free(fy);
+        free(dy);
+    }
+
+    free(fx);
+    free(fr);
+    free(dx);
+    free(dr);
+}
+
+// Check weft_rcp/rsqrt_approx_f32 stay within weft.h's relative error bounds for 0-2 steps.
+static void test_rcp_rsqrt_accuracy(void) {
+    enum { N = 10000 };
+    float *x = malloc(N * sizeof *x),
+          *r = malloc(N * sizeof *r),
+          *s = malloc(N * sizeof *s);
+    for (int i = 0; i < N; i++) {
+        x[i] = ldexpf(1.0f + (float)i / N, i % 200 - 100);
+    }
+
+    const double bound[] = {0x1p-8, 0x1p-15, 0x1p-22};
+    for (int steps = 0; steps < len(bound); steps++) {
+        Builder* b = weft_builder();
+        V32 v = weft_load_32(b,2);
+        weft_store_32(b,0, weft_rcp_approx_f32  (b,v,steps));
+        weft_store_32(b,1, weft_rsqrt_approx_f32(b,v,steps));
+        Program* p = weft_compile(b);
+        weft_run(p, N, (void*[]){r,s,x});
+        free(p);
+
+        for (int i = 0; i < N; i++) {
+            const double rcp   = 1/(double)x[i],
+                         rsqrt = 1/sqrt((double)x[i]);
+            assert(fabs((double)r[i] - rcp  ) <= bound[steps] * rcp  );
+            assert(fabs((double)s[i] - rsqrt) <= bound[steps] * rsqrt);
+        }
+    }
+
+    free(x);
+    free(r);
+    free(s);
+}
+
+// Hardware f16 stages must match C's own f16 conversions and f32-then-round arithmetic exactly.
+static void test_f16_bit_exact(void) {
+    enum { N = 1<<16 };
+    uint16_t *h = malloc(N * sizeof *h),
+             *r = malloc(N * sizeof *r);
+    uint32_t *f = malloc(N * sizeof *f),
+             *w = malloc(N * sizeof *w);
+    for (int i = 0; i < N; i++) {
+        h[i] = (uint16_t)i;
+        // Every f32 sign and exponent, with mantissas alternating between f16 ties and noise.
+        f[i] = (uint32_t)i << 16 | (i & 1 ? 0x1000 : (uint32_t)i * 0x9e37 & 0xffff);
+    }
+
+    {
+        Builder* b = weft_builder();
+        weft_store_32(b,0, weft_widen_f16 (b, weft_load_16(b,2)));
+        weft_store_16(b,1, weft_narrow_f32(b, weft_load_32(b,3)));
+        Program* p = weft_compile(b);
+        weft_run(p, N, (void*[]){w,r,h,f});
+        free(p);
+
+        for (int i = 0; i < N; i++) {
+            __fp16 x;
+            float  y;
+            memcpy(&x, h+i, sizeof x);
+            memcpy(&y, f+i, sizeof y);
+
+            float  want_w = (float )x;
+            __fp16 want_r = (__fp16)y;
+            assert(0 == memcmp(w+i, &want_w, sizeof want_w));
+            assert(0 == memcmp(r+i, &want_r, sizeof want_r));
+        }
+    }
+
+    // 1.0, -0.1, 3.0, smallest denormal, largest finite, inf, -0, NaN.
+    uint16_t ys[] = {0x3c00, 0xae66, 0x4200, 0x0001, 0x7bff, 0x7c00, 0x8000, 0x7e01};
+    V16 (*fn[])(Builder*, V16, V16) = {weft_add_f16, weft_sub_f16, weft_mul_f16, weft_div_f16};
+    for (int j = 0; j < len(ys); j++)
+    for (int op = 0; op <= len(fn); op++) {
+        Builder* b = weft_builder();
+        V16 x = weft_load_16(b,1),
+            y = weft_uniform_16(b,2);
+        weft_store_16(b,0, op < len(fn) ? fn[op](b,x,y) : weft_sqrt_f16(b,x));
+        Program* p = weft_compile(b);
+        weft_run(p, N, (void*[]){r,h,ys+j});
+        free(p);
+
+        for (int i = 0; i < N; i++) {
+            __fp16 x16, y16;
+            memcpy(&x16, h+i , sizeof x16);
+            memcpy(&y16, ys+j, sizeof y16);
+            const float X = (float)x16,
+                        Y = (float)y16;
+
+            __fp16 want = (__fp16)( op == 0 ? X + Y
+                                  : op == 1 ? X - Y
+                                  : op == 2 ? X * Y
+                                  : op == 3 ? X / Y
+                                  :           sqrtf(X) );
+            // Which NaN payload comes out depends on operand order and codegen.
+            __fp16 got;
+            memcpy(&got, r+i, sizeof got);
+            assert(0 == memcmp(&got, &want, sizeof want)
+                || (isnan((float)got) && isnan((float)want)));
+        }
+    }
+
+    free(h);
+    free(r);
+    free(f);
+    free(w);
+}
+
+static uint16_t bf16(float f) {
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof bits);
+    if (isnan(f)) {
+        return (uint16_t)(bits >> 16 | 0x40);
+    }
+    if ((bits & 0x7f800000) == 0) {
+        bits &= 0x80000000;
+    }
+    return (uint16_t)((bits + 0x7fff + (bits >> 16 & 1)) >> 16);
+}
+static float f32(uint16_t bf16) {
+    const uint32_t bits = (uint32_t)bf16 << 16;
+    float f;
+    memcpy(&f, &bits, sizeof f);
+    return f;
+}
+
+// bf16 stages, hardware or not, must match these scalar bf16() and f32() conversions exactly.
+static void test_bf16_bit_exact(void) {
+    enum { N = 1<<16 };
+    uint16_t *h = malloc(N * sizeof *h),
+             *r = malloc(N * sizeof *r);
+    float    *f = malloc(N * sizeof *f),
+             *w = malloc(N * sizeof *w);
+    for (int i = 0; i < N; i++) {
+        h[i] = (uint16_t)i;
+        const uint32_t bits = (uint32_t)i << 16 | (i & 1 ? 0x8000 : (uint32_t)i * 0x9e37 & 0xffff);
+        memcpy(f+i, &bits, sizeof bits);
+    }
+
+    {
+        Builder* b = weft_builder();
+        weft_store_32(b,0, weft_widen_bf16 (b, weft_load_16(b,2)));
+        weft_store_16(b,1, weft_narrow_bf16(b, weft_load_32(b,3)));
+        Program* p = weft_compile(b);
+        weft_run(p, N, (void*[]){w,r,h,f});
+        free(p);
+
+        for (int i = 0; i < N; i++) {
+            const float want = f32(h[i]);
+            assert(0 == memcmp(w+i, &want, sizeof want));
+            assert(r[i] == bf16(f[i]));
+        }
+    }
+
+    // 1.0, -0.1, 3.0, a denormal, largest finite, inf, -0, NaN.
+    const uint16_t ys[] = {0x3f80, 0xbdcd, 0x4040, 0x0001, 0x7f7f, 0x7f80, 0x8000, 0x7fc1};
+    V16 (*fn[])(Builder*, V16, V16) = {weft_add_bf16, weft_sub_bf16, weft_mul_bf16, weft_div_bf16};
+    for (int j = 0; j < len(ys); j++)
+    for (int op = 0; op < len(fn); op++) {
+        Builder* b = weft_builder();
+        weft_store_16(b,0, fn[op](b, weft_load_16(b,1), weft_splat_16(b, (int16_t)ys[j])));
+        Program* p = weft_compile(b);
+        weft_run(p, N, (void*[]){r,h});
+        free(p);
+
+        for (int i = 0; i < N; i++) {
+            const float X = f32(h[i]),
+                        Y = f32(ys[j]);
+            const uint16_t want = bf16( op == 0 ? X + Y
+                                      : op == 1 ? X - Y
+                                      : op == 2 ? X * Y
+                                      :           X / Y );
+            // Which NaN comes out of NaN+NaN depends on argument order, which weft may swap.
+            assert(r[i] == want || (isnan(f32(r[i])) && isnan(f32(want))));
+        }
+    }
+
+    free(h);
+    free(r);
+    free(f);
+    free(w);
+}
+
+static void test_lut16(void) {
+    uint8_t idx[256], hex[256];
+    for (int i = 0; i < 256; i++) {
+        idx[i] = (uint8_t)i;
+    }
+    char table[16] = "0123456789abcdef";
+
+    Builder* b = weft_builder();
+    weft_store_8(b,0, weft_lut16_8(b,2, weft_load_8(b,1)));
+    Program* p = weft_compile(b);
+    weft_run(p, len(idx), (void*[]){hex,idx,table});
+    free(p);
+
+    for (int i = 0; i < 256; i++) {
+        assert(hex[i] == (i < 16 ? table[i] : 0));
+    }
+}
+
+static void test_lut32(void) {
+    uint8_t idx[256], r[256];
+    for (int i = 0; i < 256; i++) {
+        idx[i] = (uint8_t)(i * 37);
+    }
+    char table[32] = "0123456789abcdefghijklmnopqrstuv";
+
+    Builder* b = weft_builder();
+    weft_store_8(b,0, weft_lut32_8(b,2, weft_load_8(b,1)));
+    Program* p = weft_compile(b);
+    weft_run(p, len(idx), (void*[]){r,idx,table});
+    free(p);
+
+    for (int i = 0; i < 256; i++) {
+        assert(r[i] == (idx[i] < 32 ? table[idx[i]] : 0));
+    }
+}
+
+static void test_shuffle(void) {
+    uint16_t s16[37], d16[37];
+    uint32_t s32[37], d32[37];
+    uint64_t s64[37], d64[37];
+    for (int i = 0; i < len(s16); i++) {
+        s16[i] = (uint16_t)(0x0102 * (unsigned)i);
+        s32[i] = 0x01020304u * (uint32_t)i;
+        s64[i] = (uint64_t)0x0102030405060708 * (uint64_t)i;
+    }
+
+    Builder* b = weft_builder();
+    weft_store_16(b,0, weft_shuffle_16(b, weft_load_16(b,1), 0x0001));
+    weft_store_32(b,2, weft_shuffle_32(b, weft_load_32(b,3), 0x00ff0203));
+    weft_store_64(b,4, weft_shuffle_64(b, weft_load_64(b,5), 0x8080808004050607));
+    Program* p = weft_compile(b);
+    weft_run(p, len(s16), (void*[]){d16,s16, d32,s32, d64,s64});
+    free(p);
+
+    for (int i = 0; i < len(s16); i++) {
+        assert(d16[i] == __builtin_bswap16(s16[i]));
+        assert(d32[i] == (__builtin_bswap32(s32[i]) & 0xff00ffff));
+        assert(d64[i] == (uint32_t)__builtin_bswap64(s64[i]));
+    }
+}
+
+static int64_t saturate(double x, int bits) {
+    const double hi = ldexp(1, bits-1);
+    return isnan(x) ? 0
+         : x >= hi  ? (int64_t)(((uint64_t)1 << (bits-1)) - 1)
+         : x < -hi  ? -(int64_t)(((uint64_t)1 << (bits-2))) * 2
+         :            (int64_t)x;
+}
+
+static void test_round_cvt(void) {
+    const double vals[] = {
+        0, -0.0, 0.5, 1.5, 2.5, -0.5, -1.5, -2.5, 0.49999997, 3.7, -3.7, 1e10, -1e10,
+        32767.5, 32768, -32768, -32769, 65504, 0x1p31, -0x1p31, 0x1p31-128, 0x1p63, -0x1p63,
+        0x1p63-1024, 1e300, (double)INFINITY, -(double)INFINITY, (double)NAN,
+    };
+    enum { K = len(vals) };
+    __fp16 h[K], rh[K]; int16_t nh[K], th[K];
+    float  f[K], rf[K]; int32_t nf[K], tf[K];
+    double d[K], rd[K]; int64_t nd[K], td[K];
+    for (int i = 0; i < K; i++) {
+        h[i] = (__fp16)vals[i];
+        f[i] = (float)vals[i];
+        d[i] = vals[i];
+    }
+
+    Builder* b = weft_builder();
+    V16 H = weft_load_16(b,0);
+    V32 F = weft_load_32(b,1);
+    V64 D = weft_load_64(b,2);
+    weft_store_16(b, 3, weft_round_f16      (b,H));
+    weft_store_16(b, 4, weft_cvt_nearest_f16(b,H));
+    weft_store_16(b, 5, weft_cvt_trunc_f16  (b,H));
+    weft_store_32(b, 6, weft_round_f32      (b,F));
+    weft_store_32(b, 7, weft_cvt_nearest_f32(b,F));
+    weft_store_32(b, 8, weft_cvt_trunc_f32  (b,F));
+    weft_store_64(b, 9, weft_round_f64      (b,D));
+    weft_store_64(b,10, weft_cvt_nearest_f64(b,D));
+    weft_store_64(b,11, weft_cvt_trunc_f64  (b,D));
+    Program* p = weft_compile(b);
+    weft_run(p, K, (void*[]){h,f,d, rh,nh,th, rf,nf,tf, rd,nd,td});
+    free(p);
+
+    for (int i = 0; i < K; i++) {
+        const double hx = (double)h[i],
+                     fx = (double)f[i];
+        const __fp16 wh = (__fp16)rint(hx);
+        const float  wf = (float )rint(fx);
+        const double wd =         rint(d[i]);
+        assert(isnan(hx)   ? isnan((double)rh[i]) : 0 == memcmp(rh+i, &wh, sizeof wh));
+        assert(isnan(fx)   ? isnan((double)rf[i]) : 0 == memcmp(rf+i, &wf, sizeof wf));
+        assert(isnan(d[i]) ? isnan(        rd[i]) : 0 == memcmp(rd+i, &wd, sizeof wd));
+        assert(nh[i] == saturate(rint (hx), 16) && th[i] == saturate(trunc(hx), 16));
+        assert(nf[i] == saturate(rint (fx), 32) && tf[i] == saturate(trunc(fx), 32));
+        assert(nd[i] == saturate(rint (d[i]), 64) && td[i] == saturate(trunc(d[i]), 64));
+    }
+}
+
+static uint64_t ref_popcnt(uint64_t x) { uint64_t n = 0; for (; x; x &= x-1) { n++; } return n; }
+static uint64_t ref_clz(uint64_t x, int bits) {
+    uint64_t n = 0;
+    for (int k = bits-1; k >= 0 && !(x >> k & 1); k--) { n++; }
+    return n;
+}
+static uint64_t ref_ctz(uint64_t x, int bits) {
+    uint64_t n = 0;
+    for (int k = 0; k < bits && !(x >> k & 1); k++) { n++; }
+    return n;
+}
+static uint64_t ref_rotl(uint64_t x, uint64_t n, int bits) {
+    for (uint64_t k = 0; k < (n & (uint64_t)(bits-1)); k++) {
+        x = (x << 1 | x >> (bits-1)) & (~(uint64_t)0 >> (64-bits));
+    }
+    return x;
+}
+
+#define TEST_BITS(B)                                                                              \
+    static void test_bits_##B(void) {                                                             \
+        enum { K = 67 };                                                                          \
+        uint##B##_t x[K], n[K], pop[K], clz[K], ctz[K], rol[K], ror[K], roli[K], rori[K];         \
+        for (int i = 0; i < K; i++) {                                                             \
+            x[i] = (uint##B##_t)((uint64_t)0x9e3779b97f4a7c15 * (uint64_t)i >> (i % 64));         \
+            n[i] = (uint##B##_t)(i * 7 - 100);                                                    \
+        }                                                                                         \
+        x[0] = 0;                                                                                 \
+        x[1] = (uint##B##_t)~(uint64_t)0;                                                         \
+        x[2] = (uint##B##_t)((uint64_t)1 << (B-1));                                               \
+        x[3] = 1;                                                                                 \
+                                                                                                  \
+        Builder* b = weft_builder();                                                              \
+        V##B X = weft_load_##B(b,0),                                                              \
+             N = weft_load_##B(b,1);                                                              \
+        weft_store_##B(b,2, weft_popcnt_##B(b,X));                                                \
+        weft_store_##B(b,3, weft_clz_##B   (b,X));                                                \
+        weft_store_##B(b,4, weft_ctz_##B   (b,X));                                                \
+        weft_store_##B(b,5, weft_rotl_##B  (b,X,N));                                              \
+        weft_store_##B(b,6, weft_rotr_##B  (b,X,N));                                              \
+        weft_store_##B(b,7, weft_rotl_##B  (b,X, weft_splat_##B(b,B+3)));                         \
+        weft_store_##B(b,8, weft_rotr_##B  (b,X, weft_splat_##B(b,3)));                           \
+        Program* p = weft_compile(b);                                                             \
+        weft_run(p, K, (void*[]){x,n,pop,clz,ctz,rol,ror,roli,rori});                             \
+        free(p);                                                                                  \
+                                                                                                  \
+        for (int i = 0; i < K; i++) {                                                             \
+            assert(pop [i] == ref_popcnt(x[i]));                                                  \
+            assert(clz [i] == ref_clz (x[i], B));                                                 \
+            assert(ctz [i] == ref_ctz (x[i], B));                                                 \
+            assert(rol [i] == ref_rotl(x[i], n[i], B));                                           \
+            assert(ror [i] == ref_rotl(x[i], (uint64_t)-n[i], B));                                \
+            assert(roli[i] == ref_rotl(x[i], 3, B));                                              \
+            assert(rori[i] == ref_rotl(x[i], B-3, B));                                            \
+        }                                                                                         \
+    }
+TEST_BITS( 8)
+TEST_BITS(16)
+TEST_BITS(32)
+TEST_BITS(64)
+
+static void test_bswap(void) {
+    uint16_t s16[37], d16[37];
+    uint32_t s32[37], d32[37];
+    uint64_t s64[37], d64[37];
+    for (int i = 0; i < len(s16); i++) {
+        s16[i] = (uint16_t)(0x0102 * (unsigned)i);
+        s32[i] = 0x01020304u * (uint32_t)i;
+        s64[i] = (uint64_t)0x0102030405060708 * (uint64_t)i;
+    }
+
+    Builder* b = weft_builder();
+    weft_store_16(b,0, weft_bswap_16(b, weft_load_16(b,1)));
+    weft_store_32(b,2, weft_bswap_32(b, weft_load_32(b,3)));
+    weft_store_64(b,4, weft_bswap_64(b, weft_load_64(b,5)));
+    Program* p = weft_compile(b);
+    weft_run(p, len(s16), (void*[]){d16,s16, d32,s32, d64,s64});
+    free(p);
+
+    for (int i = 0; i < len(s16); i++) {
+        assert(d16[i] == __builtin_bswap16(s16[i]));
+        assert(d32[i] == __builtin_bswap32(s32[i]));
+        assert(d64[i] == __builtin_bswap64(s64[i]));
+    }
+}
+
+static void test_index(void) {
+    int32_t i32[37];
+    int64_t i64[37];
+    Builder* b = weft_builder();
+    weft_store_32(b,0, weft_index_32(b));
+    weft_store_64(b,1, weft_add_i64(b, weft_index_64(b), weft_splat_64(b, (int64_t)1<<40)));
+    Program* p = weft_compile(b);
+    weft_run(p, len(i32), (void*[]){i32,i64});
+    free(p);
+
+    for (int i = 0; i < len(i32); i++) {
+        assert(i32[i] == i);
+        assert(i64[i] == ((int64_t)1<<40) + i);
+    }
+}
+
+static void test_load_strided(void) {
+    struct { int64_t q; int32_t d; int16_t w; int8_t c, unused; } aos[37];
+    for (int i = 0; i < len(aos); i++) {
+        aos[i].q = (int64_t)i << 40 | i;
+        aos[i].d = -i * 1000;
+        aos[i].w = (int16_t)(i * 7);
+        aos[i].c = (int8_t)(i - 20);
+    }
+    const int stride = (int)sizeof *aos;
+
+    Builder* b = weft_builder();
+    weft_store_64(b,4, weft_load_strided_64(b,0, stride));
+    weft_store_32(b,5, weft_load_strided_32(b,1, stride));
+    weft_store_16(b,6, weft_load_strided_16(b,2, stride));
+    weft_store_8 (b,7, weft_load_strided_8 (b,3, stride));
+    weft_store_32(b,9, weft_load_strided_32(b,8, 4));  // A unit stride is just a load.
+    Program* p = weft_compile(b);
+
+    const int ns[] = {0,1,7,8,9,len(aos)};
+    for (int j = 0; j < len(ns); j++) {
+        int64_t q[len(aos)] = {0};
+        int32_t d[len(aos)] = {0}, u[len(aos)] = {0}, src[len(aos)];
+        int16_t w[len(aos)] = {0};
+        int8_t  c[len(aos)] = {0};
+        for (int i = 0; i < len(aos); i++) {
+            src[i] = i*i;
+        }
+        weft_run(p, ns[j], (void*[]){&aos[0].q, &aos[0].d, &aos[0].w, &aos[0].c,
+                                     q, d, w, c, src, u});
+        for (int i = 0; i < len(aos); i++) {
+            const bool ran = i < ns[j];
+            assert(q[i] == (ran ? aos[i].q : 0));
+            assert(d[i] == (ran ? aos[i].d : 0));
+            assert(w[i] == (ran ? aos[i].w : 0));
+            assert(c[i] == (ran ? aos[i].c : 0));
+            assert(u[i] == (ran ? i*i      : 0));
+        }
+    }
+    free(p);
+}
+
+static void test_if_any(void) {
+    int32_t x[37], y[37], z[37], w[37];
+    for (int i = 0; i < len(x); i++) {
+        x[i] = (i/8) % 2 == 0 && i % 5 == 0 ? i : -1;  // Lanes 8-15 and 24-31 are all false.
+        y[i] = z[i] = w[i] = 42;
+    }
+
+    Builder* b = weft_builder();
+    V32 X    = weft_load_32(b,0),
+        mask = weft_lt_s32(b, weft_splat_32(b,-1), X);
+    weft_if_any_32(b, mask);
+    {
+        // y = x > -1 ? x*x + 1 : y
+        V32 sq = weft_add_i32(b, weft_mul_i32(b,X,X), weft_splat_32(b,1));
+        weft_store_32(b,1, weft_sel_32(b, mask, sq, weft_load_32(b,1)));
+
+        // Never true, so w is never written.
+        weft_if_any_32(b, weft_eq_i32(b, X, weft_splat_32(b,-2)));
+        weft_store_32(b,3, weft_splat_32(b,7));
+        weft_endif(b);
+    }
+    weft_endif(b);
+    weft_store_32(b,2, weft_add_i32(b, X, weft_uniform_32(b,4)));
+    Program* p = weft_compile(b);
+
+    int32_t one = 1;
+    weft_run(p, len(x), (void*[]){x,y,z,w,&one});
+    free(p);
+
+    for (int i = 0; i < len(x); i++) {
+        assert(y[i] == (x[i] >= 0 ? i*i + 1 : 42));
+        assert(z[i] == x[i] + 1);
+        assert(w[i] == 42);
+    }
+
+    // When no lane is ever set, the whole region is skipped.
+    for (int i = 0; i < len(x); i++) {
+        x[i] = -1;
+        y[i] = 42;
+    }
+    b = weft_builder();
+    X = weft_load_32(b,0);
+    weft_if_any_32(b, weft_lt_s32(b, weft_splat_32(b,-1), X));
+    weft_store_32(b,1, weft_splat_32(b,7));
+    weft_endif(b);
+    p = weft_compile(b);
+    weft_run(p, len(x), (void*[]){x,y});
+    free(p);
+    for (int i = 0; i < len(x); i++) {
+        assert(y[i] == 42);
+    }
+}
+
+// Compressing stores split across threads, each counting its share in a first pass, first with
+// and without a store after them, then with every 8-lane mask in turn.
+#define TEST_STORE_COMPRESS(B)                                                                    \
+    static void test_store_compress_##B(void) {                                                   \
+        uint##B##_t x[37], dst[38], copy[37];                                                     \
+        for (int i = 0; i < len(x); i++) {                                                        \
+            x[i] = (uint##B##_t)(i % 3 == 0 ? 0x80 + i : i);                                      \
+        }                                                                                         \
+        for (int last = 0; last < 2; last++) {                                                    \
+            memset(dst, 0x42, sizeof dst);                                                        \
+            int64_t count = 1;                                                                    \
+                                                                                                  \
+            Builder* b = weft_builder();                                                          \
+            V##B X = weft_load_##B(b,0);                                                          \
+            weft_store_compress_##B(b,1,2, weft_shr_u##B(b, X, weft_splat_##B(b,7)), X);          \
+            if (!last) {                                                                          \
+                weft_store_##B(b,3, X);                                                           \
+            }                                                                                     \
+            Program* p = weft_compile(b);                                                         \
+            weft_run_parallel(p, len(x), (void*[]){x,dst,&count,copy}, 4);                         \
+            free(p);                                                                              \
+                                                                                                  \
+            int64_t want = 1;                                                                     \
+            for (int i = 0; i < len(x); i++) {                                                    \
+                if (x[i] >= 0x80) {                                                               \
+                    assert(dst[want++] == x[i]);                                                  \
+                }                                                                                 \
+            }                                                                                     \
+            assert(count == want && count > 1);                                                   \
+            assert(dst[0] == (uint##B##_t)0x4242424242424242);                                    \
+            for (int i = (int)want; i < len(dst); i++) {                                          \
+                assert(dst[i] == (uint##B##_t)0x4242424242424242);                                \
+            }                                                                                     \
+        }                                                                                         \
+                                                                                                  \
+        enum { LEN = 8*256 + 5 };                                                                 \
+        uint##B##_t *y = malloc(LEN * sizeof *y), *packed = malloc(LEN * sizeof *packed);         \
+        int64_t want = 0;                                                                         \
+        for (int i = 0; i < LEN; i++) {                                                           \
+            y[i] = (uint##B##_t)((i/8 >> i%8 & 1) << 7 | (i & 0x7f));                             \
+            want += y[i] >= 0x80;                                                                 \
+        }                                                                                         \
+        Builder* b = weft_builder();                                                              \
+        V##B Y = weft_load_##B(b,0);                                                              \
+        weft_store_compress_##B(b,1,2, weft_shr_u##B(b, Y, weft_splat_##B(b,7)), Y);              \
+        Program* p = weft_compile(b);                                                             \
+        int64_t count = 0;                                                                        \
+        weft_run_parallel(p, LEN, (void*[]){y,packed,&count}, 4);                                 \
+        free(p);                                                                                  \
+        assert(count == want);                                                                    \
+        for (int i = 0, j = 0; i < LEN; i++) {                                                    \
+            if (y[i] >= 0x80) {                                                                   \
+                assert(packed[j++] == y[i]);                                                      \
+            }                                                                                     \
+        }                                                                                         \
+        free(y);                                                                                  \
+        free(packed);                                                                             \
+    }
+TEST_STORE_COMPRESS( 8)
+TEST_STORE_COMPRESS(16)
+TEST_STORE_COMPRESS(32)
+TEST_STORE_COMPRESS(64)
+
+#define TEST_STORE_MASKED(B)                                                                      \
+    static void test_store_masked_##B(void) {                                                     \
+        uint##B##_t x[37], dst[40], copy[37];                                                     \
+        for (int i = 0; i < len(x); i++) {                                                        \
+            x[i] = (uint##B##_t)(i % 3 == 0 ? 0x80 + i : i);                                      \
+        }                                                                                         \
+        for (int last = 0; last < 2; last++) {                                                    \
+            memset(dst, 0x42, sizeof dst);                                                        \
+                                                                                                  \
+            Builder* b = weft_builder();                                                          \
+            V##B X = weft_load_##B(b,0);                                                          \
+            weft_store_masked_##B(b,1, weft_shr_u##B(b, X, weft_splat_##B(b,7)), X);              \
+            if (!last) {                                                                          \
+                weft_store_##B(b,2, X);                                                           \
+            }                                                                                     \
+            Program* p = weft_compile(b);                                                         \
+            weft_run(p, len(x), (void*[]){x,dst,copy});                                           \
+            free(p);                                                                              \
+                                                                                                  \
+            for (int i = 0; i < len(dst); i++) {                                                  \
+                assert(dst[i] == (i < len(x) && x[i] >= 0x80 ? x[i]                               \
+                                                             : (uint##B##_t)0x4242424242424242)); \
+            }                                                                                     \
+        }                                                                                         \
+    }
+TEST_STORE_MASKED( 8)
+TEST_STORE_MASKED(16)
+TEST_STORE_MASKED(32)
+TEST_STORE_MASKED(64)
+
+#define TEST_SCAN(B)                                                                              \
+    static void test_scan_##B(void) {                                                             \
+        enum { LEN = 1001 };                                                                      \
+        uint##B##_t *x   = malloc(LEN * sizeof *x),                                               \
+                    *sum = malloc(LEN * sizeof *sum),                                             \
+                    *mx  = malloc(LEN * sizeof *mx),                                              \
+                    *mu  = malloc(LEN * sizeof *mu),                                              \
+                    *ss  = malloc(LEN * sizeof *ss);                                              \
+        uint64_t seed = 1;                                                                        \
+        for (int i = 0; i < LEN; i++) {                                                           \
+            seed = seed * 6364136223846793005u + 1442695040888963407u;                            \
+            x[i] = (uint##B##_t)(seed >> (64-B));                                                 \
+        }                                                                                         \
+                                                                                                  \
+        for (int nested = 0; nested < 2; nested++) {                                              \
+            Builder* b = weft_builder();                                                          \
+            V##B X = weft_load_##B(b,0),                                                          \
+                 S = weft_scan_add_##B(b,X);                                                      \
+            weft_store_##B(b,1, S);                                                               \
+            weft_store_##B(b,2, weft_scan_max_s##B(b,X));                                         \
+            weft_store_##B(b,3, weft_scan_max_u##B(b,X));                                         \
+            if (nested) {                                                                         \
+                weft_store_##B(b,4, weft_scan_add_##B(b,S));                                      \
+            }                                                                                     \
+            Program* p = weft_compile(b);                                                         \
+                                                                                                  \
+            const int ns[] = {0,1,5,8,37,LEN};                                                    \
+            for (int threads = 0; threads <= 9; threads += 3) {                                   \
+            for (int j = 0; j < len(ns); j++) {                                                   \
+                const int n = ns[j];                                                              \
+                threads ? weft_run_parallel(p, n, (void*[]){x,sum,mx,mu,ss}, threads)             \
+                        : weft_run         (p, n, (void*[]){x,sum,mx,mu,ss});                     \
+                                                                                                  \
+                uint##B##_t s = 0, s2 = 0, m = 0;                                                 \
+                int##B##_t  ms = (int##B##_t)((uint##B##_t)1 << (B-1));                           \
+                for (int i = 0; i < n; i++) {                                                     \
+                    s  = (uint##B##_t)(s  + x[i]);                                                \
+                    s2 = (uint##B##_t)(s2 + s);                                                   \
+                    ms = ms < (int##B##_t)x[i] ? (int##B##_t)x[i] : ms;                           \
+                    m  = m  < x[i] ? x[i] : m;                                                    \
+                    assert(sum[i] == s);                                                          \
+                    assert(mx [i] == (uint##B##_t)ms);                                            \
+                    assert(mu [i] == m);                                                          \
+                    assert(!nested || ss[i] == s2);                                               \
+                }                                                                                 \
+            }                                                                                     \
+            }                                                                                     \
+            free(p);                                                                              \
+        }                                                                                         \
+        free(x);                                                                                  \
+        free(sum);                                                                                \
+        free(mx);                                                                                 \
+        free(mu);                                                                                 \
+        free(ss);                                                                                 \
+    }
+TEST_SCAN( 8)
+TEST_SCAN(16)
+TEST_SCAN(32)
+TEST_SCAN(64)
+
+static void test_histogram(void) {
+    enum { LEN = 1001 };
+    uint32_t x[LEN], want[2][64], got[2][64];
+    for (int i = 0; i < LEN; i++) {
+        x[i] = (uint32_t)(i * 7 % 64);
+    }
+
+    // Buckets x spread across a chunk's lanes; buckets x&3 collide within it.
+    Builder* b = weft_builder();
+    V32 X = weft_load_32(b,0);
+    weft_histogram_add_32(b,1, X, weft_add_i32(b, X, weft_splat_32(b,1)));
+    weft_histogram_add_32(b,2, weft_and_32(b, X, weft_splat_32(b,3)), weft_splat_32(b,1));
+    weft_histogram_add_32(b,2, X, weft_splat_32(b,0));
+    Program* p = weft_compile(b);
+
+    const int ns[] = {0,1,5,8,37,LEN};
+    for (int threads = 0; threads <= 9; threads += 3) {
+        for (int j = 0; j < len(ns); j++) {
+            const int n = ns[j];
+            memset(want, 0, sizeof want);
+            memset(got , 0, sizeof got );
+            for (int i = 0; i < n; i++) {
+                want[0][x[i]    ] += x[i] + 1;
+                want[1][x[i] & 3] += 1;
+            }
+            threads ? weft_run_parallel(p, n, (void*[]){x,got[0],got[1]}, threads)
+                    : weft_run         (p, n, (void*[]){x,got[0],got[1]});
+            assert(0 == memcmp(want, got, sizeof want));
+        }
+    }
+    free(p);
+}
+
+static void test_run_batch(void) {
+    enum { JOBS = 40, LEN = 77 };
+    int32_t src[LEN], want[JOBS][LEN], got[JOBS][LEN];
+    for (int i = 0; i < LEN; i++) {
+        src[i] = i*i - 50;
+    }
+
+    // A scan checks that each job starts from fresh state despite sharing scratch, and runs of
+    // jobs with the same and different uniforms that each sees its own.
+    Program* p[2];
+    {
+        Builder* b = weft_builder();
+        weft_store_32(b,1, weft_mul_i32(b, weft_load_32(b,0), weft_uniform_32(b,2)));
+        p[0] = weft_compile(b);
+    }
+    {
+        Builder* b = weft_builder();
+        weft_store_32(b,1, weft_scan_add_32(b, weft_load_32(b,0)));
+        p[1] = weft_compile(b);
+    }
+
+    int32_t k[2] = {3, -7};
+    void* ptr[JOBS][3];
+    weft_Job job[JOBS];
+    for (int j = 0; j < JOBS; j++) {
+        ptr[j][0] = src;
+        ptr[j][1] = got[j];
+        ptr[j][2] = k + j/4 % 2;
+        job[j] = (weft_Job){.p=p[j%3 == 0], .ptr=ptr[j], .n=j*37 % LEN};
+    }
+
+    for (int threads = 0; threads <= 9; threads += 3) {
+        memset(want, 0, sizeof want);
+        memset(got , 0, sizeof got );
+        for (int j = 0; j < JOBS; j++) {
+            weft_run(job[j].p, job[j].n, (void*[]){src, want[j], ptr[j][2]});
+        }
+        weft_run_batch(job, JOBS, threads);
+        assert(0 == memcmp(want, got, sizeof want));
+    }
+    weft_run_batch(job, 0, 4);
+    free(p[0]);
+    free(p[1]);
+}
+
+static void test_run_2d(void) {
+    enum { W = 13, H = 7, SRC_STRIDE = 16, DST_STRIDE = 20 };
+    uint16_t src[H][SRC_STRIDE];
+    int32_t  dst[H][DST_STRIDE], sum[H][DST_STRIDE];
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < SRC_STRIDE; x++) {
+            src[y][x] = (uint16_t)(y*100 + x);
+        }
+    }
+
+    Builder* b = weft_builder();
+    {
+        V32 s = weft_widen_u16(b, weft_load_16(b,0)),
+            k = weft_mul_i32(b, weft_uniform_32(b,1), weft_splat_32(b,2)),
+            r = weft_mul_i32(b, weft_row_32(b), weft_splat_32(b,1000));
+        weft_store_32(b,2, weft_add_i32(b, weft_mul_i32(b, s, k),
+                                           weft_add_i32(b, r, weft_index_32(b))));
+        weft_store_32(b,3, weft_scan_add_32(b, s));
+    }
+    Program* p = weft_compile(b);
+
+    int32_t k = 3;
+    for (int threads = 0; threads <= 4; threads++) {
+        memset(dst, 0xff, sizeof dst);
+        memset(sum, 0xff, sizeof sum);
+        weft_run_2d(p, W, H, (void*[]){src, &k, dst, sum},
+                    (const int64_t[]){sizeof *src, 0, sizeof *dst, sizeof *sum}, threads);
+
+        int32_t total = 0;
+        for (int y = 0; y < H; y++) {
+            for (int x = 0; x < DST_STRIDE; x++) {
+                total += x < W ? src[y][x] : 0;
+                assert(dst[y][x] == (x < W ? src[y][x]*6 + y*1000 + x : -1));
+                assert(sum[y][x] == (x < W ? total : -1));
+            }
+        }
+    }
+
+    // Without a scan, rows split across threads.
+    free(p);
+    b = weft_builder();
+    weft_store_32(b,1, weft_add_i32(b, weft_row_32(b), weft_uniform_32(b,2)));
+    p = weft_compile(b);
+    for (int threads = 1; threads <= 8; threads++) {
+        memset(dst, 0xff, sizeof dst);
+        weft_run_2d(p, W, H, (void*[]){NULL, dst, &k}, (const int64_t[]){0, sizeof *dst, 0},
+                    threads);
+        for (int y = 0; y < H; y++) {
+            for (int x = 0; x < DST_STRIDE; x++) {
+                assert(dst[y][x] == (x < W ? y + 3 : -1));
+            }
+        }
+    }
+    free(p);
+}
+
+static void test_stream(void) {
+    enum { LEN = 97 };
+    int32_t x[LEN], want[2][LEN], got[2][LEN];
+    uint32_t want_hist[16] = {0}, got_hist[16] = {0};
+    for (int i = 0; i < LEN; i++) {
+        x[i] = i*i % 23 - 11;
+    }
+
+    Builder* b = weft_builder();
+    {
+        V32 X = weft_load_32(b,0);
+        weft_store_32(b,1, weft_add_i32(b, weft_scan_add_32(b,X), weft_uniform_32(b,3)));
+        weft_store_masked_32(b,2, weft_and_32(b, X, weft_splat_32(b,1)), X);
+        weft_histogram_add_32(b,4, weft_and_32(b, X, weft_splat_32(b,15)), weft_splat_32(b,1));
+    }
+    Program* p = weft_compile(b);
+
+    int32_t k = 1000;
+    memset(want, 0, sizeof want);
+    weft_run(p, LEN, (void*[]){x, want[0], want[1], &k, want_hist});
+
+    // Pushes of every awkward size, each pointing at its own slice of the arrays.
+    const int pushes[] = {3,1,0,13,8,2,5,1,1,1,1,1,1,1,1,40,17};
+    memset(got, 0, sizeof got);
+    weft_Stream* s = weft_stream_open(p);
+    for (int j = 0, off = 0; j < len(pushes); off += pushes[j++]) {
+        weft_stream_push(s, pushes[j], (void*[]){x+off, got[0]+off, got[1]+off, &k, got_hist});
+    }
+    weft_stream_flush(s);
+    assert(0 == memcmp(want, got, sizeof want));
+    assert(0 == memcmp(want_hist, got_hist, sizeof want_hist));
+
+    // Flushing with nothing held back is fine too.
+    s = weft_stream_open(p);
+    weft_stream_push(s, 16, (void*[]){x, got[0], got[1], &k, got_hist});
+    weft_stream_flush(s);
+    free(p);
+}
+
+static void test_stream_strided(void) {
+    // A byte at the very end of each 16-byte struct walking forward, and an int at the end of each
+    // walking backward, both staged one element at a time without reading past either end.
+    enum { LEN = 11, STRIDE = 16 };
+    uint8_t* aos = malloc(LEN * STRIDE);
+    for (int i = 0; i < LEN * STRIDE; i++) {
+        aos[i] = (uint8_t)(i * 7);
+    }
+    uint8_t* const first = aos + 15,
+           * const last  = aos + (LEN-1) * STRIDE + 12;
+
+    Builder* b = weft_builder();
+    weft_store_8 (b,2, weft_load_strided_8 (b,0, +STRIDE));
+    weft_store_32(b,3, weft_load_strided_32(b,1, -STRIDE));
+    Program* p = weft_compile(b);
+
+    uint8_t  want8[LEN];
+    uint32_t want32[LEN];
+    weft_run(p, LEN, (void*[]){first, last, want8, want32});
+    for (int i = 0; i < LEN; i++) {
+        uint32_t w;
+        memcpy(&w, last - i * STRIDE, sizeof w);
+        assert(want8[i] == first[i * STRIDE]);
+        assert(want32[i] == w);
+    }
+
+    const int pushes[][3] = {{3,5,3}, {9,2,0}, {1,0,10}};
+    for (int t = 0; t < len(pushes); t++) {
+        uint8_t  got8[LEN] = {0};
+        uint32_t got32[LEN] = {0};
+        weft_Stream* s = weft_stream_open(p);
+        for (int j = 0, off = 0; j < len(pushes[t]); off += pushes[t][j++]) {
+            weft_stream_push(s, pushes[t][j], (void*[]){first + off * STRIDE, last - off * STRIDE,
+                                                        got8 + off, got32 + off});
+        }
+        weft_stream_flush(s);
+        assert(0 == memcmp(want8 , got8 , sizeof want8 ));
+        assert(0 == memcmp(want32, got32, sizeof want32));
+    }
+    free(p);
+    free(aos);
+}
+
+#if !defined(__wasm__)
+    // Create an empty file under $TMPDIR, or /tmp, writing its name to path.
+    static bool temp_file(char path[64]) {
+        const char* dir = getenv("TMPDIR");
+        if (snprintf(path, 64, "%s/weft_test_XXXXXX", dir && *dir ? dir : "/tmp") >= 64) {
+            return false;
+        }
+        const int fd = mkstemp(path);
+        if (fd < 0) {
+            return false;
+        }
+        close(fd);
+        return true;
+    }
+
+    static long file_size(const char* path) {
+        FILE* f = fopen(path, "rb");
+        assert(f && fseek(f, 0, SEEK_END) == 0);
+        const long size = ftell(f);
+        fclose(f);
+        return size;
+    }
+#endif
+
+extern int64_t weft_nontemporal_runs, weft_prefetch_runs;
+
+static void test_run_files(void) {
+#if !defined(__wasm__)
+    // Enough instances for several windows per file, and a few left over for the tail.
+    enum { LEN = 300001 };
+    char in[64], out[64], wide[64], missing[64];
+    if (!temp_file(in) || !temp_file(out) || !temp_file(wide) || !temp_file(missing)) {
+        return;
+    }
+    remove(missing);
+
+    int32_t* x    = malloc(LEN * sizeof *x);
+    int32_t* want = malloc(LEN * sizeof *want);
+    int64_t* wwant = malloc(LEN * sizeof *wwant);
+    for (int i = 0; i < LEN; i++) {
+        x[i] = i*7 % 1001 - 500;
+    }
+    FILE* f = fopen(in, "wb");
+    assert(f && fwrite(x, sizeof *x, LEN, f) == LEN);
+    fclose(f);
+
+    Builder* b = weft_builder();
+    {
+        V32 X = weft_load_32(b,0);
+        weft_store_32(b,1, weft_mul_i32(b, X, weft_uniform_32(b,3)));
+        weft_store_64(b,2, weft_add_i64(b, weft_widen_s32(b,X), weft_index_64(b)));
+    }
+    Program* p = weft_compile(b);
+
+    int32_t k = 3;
+    weft_run(p, LEN, (void*[]){x, want, wwant, &k});
+    assert(weft_run_files(p, LEN, (void*[]){NULL, NULL, NULL, &k},
+                          (const char*[]){in, out, wide, NULL}, 4));
+
+    int32_t* got  = malloc(LEN * sizeof *got);
+    int64_t* wgot = malloc(LEN * sizeof *wgot);
+    f = fopen(out, "rb");
+    assert(f && fread(got, sizeof *got, LEN, f) == LEN && fgetc(f) == EOF);
+    fclose(f);
+    f = fopen(wide, "rb");
+    assert(f && fread(wgot, sizeof *wgot, LEN, f) == LEN && fgetc(f) == EOF);
+    fclose(f);
+    assert(0 == memcmp(want, got, LEN * sizeof *got));
+    assert(0 == memcmp(wwant, wgot, LEN * sizeof *wgot));
+
+    // Whether to store non-temporally is up to each thread's whole share, not each 1MB window of
+    // it, so both runs here take the non-temporal copy if the program has one.
+    {
+        Builder* nb = weft_builder();
+        weft_nontemporal_stores(nb, LEN-1);
+        weft_store_32(nb,1, weft_load_32(nb,0));
+        Program* np = weft_compile(nb);
+
+        const int64_t before = weft_nontemporal_runs;
+        weft_run(np, LEN-1, (void*[]){x, got});
+        const bool copied = weft_nontemporal_runs > before;
+
+        const int64_t files = weft_nontemporal_runs;
+        assert(weft_run_files(np, LEN, (void*[]){NULL, NULL}, (const char*[]){in, out}, 1));
+        assert(copied == (weft_nontemporal_runs > files));
+        f = fopen(out, "rb");
+        assert(f && fread(got, sizeof *got, LEN, f) == LEN);
+        fclose(f);
+        assert(0 == memcmp(x, got, LEN * sizeof *got));
+        free(np);
+    }
+
+    // Scans, histograms and compressing stores split across threads as in weft_run_parallel().
+    {
+        Builder* sb = weft_builder();
+        V32 X = weft_load_32(sb,0);
+        weft_store_64(sb,1, weft_scan_add_64(sb, weft_widen_s32(sb,X)));
+        weft_histogram_add_32(sb,2, weft_and_32(sb, X, weft_splat_32(sb,15)), weft_splat_32(sb,1));
+        weft_store_compress_32(sb,3,4, weft_lt_s32(sb, X, weft_splat_32(sb,0)), X);
+        Program* sp = weft_compile(sb);
+
+        uint32_t hist[2][16] = {{0}};
+        int64_t  count[2] = {0};
+        int32_t* packed = malloc(2 * LEN * sizeof *packed);
+        weft_run(sp, LEN, (void*[]){x, wwant, hist[0], packed, count+0});
+        assert(weft_run_files(sp, LEN, (void*[]){NULL, NULL, hist[1], packed+LEN, count+1},
+                              (const char*[]){in, wide, NULL, NULL, NULL}, 4));
+        f = fopen(wide, "rb");
+        assert(f && fread(wgot, sizeof *wgot, LEN, f) == LEN);
+        fclose(f);
+        assert(0 == memcmp(wwant, wgot, LEN * sizeof *wgot));
+        assert(0 == memcmp(hist[0], hist[1], sizeof hist[0]));
+        assert(count[0] == count[1] && count[0] > 0);
+        assert(0 == memcmp(packed, packed+LEN, (size_t)count[0] * sizeof *packed));
+        free(packed);
+        free(sp);
+    }
+
+    // Plain pointers and files mix, and input files too short or missing fail.
+    memset(got, 0, LEN * sizeof *got);
+    assert(weft_run_files(p, LEN-1, (void*[]){NULL, got, wgot, &k},
+                          (const char*[]){in, NULL, NULL, NULL}, 1));
+    assert(0 == memcmp(want, got, (LEN-1) * sizeof *got));
+    assert(!weft_run_files(p, LEN+1, (void*[]){NULL, got, wgot, &k},
+                           (const char*[]){in, NULL, NULL, NULL}, 1));
+    assert(!weft_run_files(p, LEN, (void*[]){NULL, got, wgot, &k},
+                           (const char*[]){missing, NULL, NULL, NULL}, 1));
+    free(p);
+
+    // A file both loaded and stored is updated in place, never resized: a short one fails
+    // untouched, and a long one keeps what's past the n instances run.
+    b = weft_builder();
+    weft_store_32(b,0, weft_mul_i32(b, weft_load_32(b,0), weft_uniform_32(b,1)));
+    p = weft_compile(b);
+    assert(!weft_run_files(p, LEN+1, (void*[]){NULL, &k}, (const char*[]){in, NULL}, 4));
+    assert(file_size(in) == LEN * (long)sizeof *x);
+    assert(weft_run_files(p, LEN-1, (void*[]){NULL, &k}, (const char*[]){in, NULL}, 4));
+    assert(file_size(in) == LEN * (long)sizeof *x);
+    f = fopen(in, "rb");
+    assert(f && fread(got, sizeof *got, LEN, f) == LEN);
+    fclose(f);
+    assert(0 == memcmp(want, got, (LEN-1) * sizeof *got));
+    assert(got[LEN-1] == x[LEN-1]);
+
+    remove(in);
+    remove(out);
+    remove(wide);
+    free(p);
+    free(x);
+    free(want);
+    free(wwant);
+    free(got);
+    free(wgot);
+#endif
+}
+
+static void test_nontemporal_stores(void) {
+    enum { LEN = 203 };
+    int64_t x[LEN];
+    for (int i = 0; i < LEN; i++) {
+        x[i] = (int64_t)((uint64_t)i * 0x0102030405060708u);
+    }
+
+    // The same program three ways: always, never, and by default (never for runs this short).
+    Program* p[3];
+    for (int j = 0; j < 3; j++) {
+        Builder* b = weft_builder();
+        weft_nontemporal_stores(b, j == 0 ? 1 : j == 1 ? INT64_MAX : 0);
+        V64 X = weft_load_64(b,0);
+        weft_store_8 (b,1, weft_narrow_i16(b, weft_narrow_i32(b, weft_narrow_i64(b,X))));
+        weft_store_16(b,2, weft_narrow_i32(b, weft_narrow_i64(b,X)));
+        weft_store_32(b,3, weft_narrow_i64(b,X));
+        weft_store_64(b,4, weft_add_i64(b, X, weft_index_64(b)));
+        p[j] = weft_compile(b);
+    }
+
+    // Outputs at every alignment, for the partly-aligned paths.
+    for (int skew = 0; skew < 16; skew++) {
+        for (int n = 0; n <= LEN; n += 1 + n/2) {
+            int64_t out[3][4][LEN+2];
+            memset(out, 0, sizeof out);
+            for (int j = 0; j < 3; j++) {
+                void* ptr[5] = {x};
+                for (int k = 0; k < 4; k++) {
+                    ptr[k+1] = (char*)out[j][k] + skew;
+                }
+                weft_run(p[j], n, ptr);
+            }
+            assert(0 == memcmp(out[0], out[1], sizeof out[0]));
+            assert(0 == memcmp(out[0], out[2], sizeof out[0]));
+        }
+    }
+    for (int j = 0; j < 3; j++) {
+        free(p[j]);
+    }
+}
+
+static void test_prefetch(void) {
+    // Long enough to load past the 1MB where prefetching starts.
+    enum { LEN = 70001 };
+    int32_t* x = malloc(LEN * sizeof *x);
+    int32_t* s = malloc(LEN * 3 * sizeof *s);
+    uint8_t* y = malloc(LEN * sizeof *y);
+    for (int i = 0; i < LEN; i++) {
+        x[i] = i;
+        s[3*i+0] = -i;
+        s[3*i+1] = 3*i;
+        s[3*i+2] = i ^ 0x55;
+        y[i] = (uint8_t)(i*7);
+    }
+
+    // Never, by default, every distance up to a chunk, and farther ahead than the whole run.
+    const int64_t distances[] = {-1, 0, 1, 7, 8, 9, 1000, 2*LEN, INT64_MAX};
+    int32_t* want = malloc(LEN * sizeof *want);
+    int32_t* got  = malloc(LEN * sizeof *got);
+    for (int j = 0; j < len(distances); j++) {
+        Builder* b = weft_builder();
+        weft_prefetch_distance(b, distances[j]);
+        {
+            V32 X = weft_load_32(b,0),
+                S = weft_load_strided_32(b,1, 3*sizeof *s),
+                Y = weft_widen_u16(b, weft_widen_u8(b, weft_load_8(b,2)));
+            weft_store_32(b,3, weft_add_i32(b, weft_add_i32(b,X,S), Y));
+        }
+        Program* p = weft_compile(b);
+
+        weft_run(p, LEN, (void*[]){x, s+1, y, j ? got : want});
+        assert(0 == memcmp(want, got, LEN * sizeof *got) || j == 0);
+        free(p);
+    }
+    for (int i = 0; i < LEN; i++) {
+        assert(want[i] == i + 3*i + (uint8_t)(i*7));
+    }
+    free(x);
+    free(s);
+    free(y);
+    free(want);
+    free(got);
+
+#if !defined(__wasm__)
+    // weft_run_files() runs a file 1MB at a time, just short of where prefetching starts, but
+    // whether to prefetch is up to each thread's whole share.
+    enum { FLEN = 300001 };
+    char in[64];
+    if (!temp_file(in)) {
+        return;
+    }
+    int32_t* fx = malloc(FLEN * sizeof *fx);
+    for (int i = 0; i < FLEN; i++) {
+        fx[i] = i;
+    }
+    FILE* f = fopen(in, "wb");
+    assert(f && fwrite(fx, sizeof *fx, FLEN, f) == FLEN);
+    fclose(f);
+
+    Builder* b = weft_builder();
+    weft_store_32(b,1, weft_add_i32(b, weft_load_32(b,0), weft_splat_32(b,1)));
+    Program* p = weft_compile(b);
+
+    const int64_t before = weft_prefetch_runs;
+    assert(weft_run_files(p, FLEN, (void*[]){NULL, fx}, (const char*[]){in, NULL}, 1));
+    assert(weft_prefetch_runs > before);
+    for (int i = 0; i < FLEN; i++) {
+        assert(fx[i] == i+1);
+    }
+    remove(in);
+    free(p);
+    free(fx);
+#endif
+}
+
+static void test_emit_c(void) {
+    FILE* f = tmpfile();
+    if (!f) {
+        return;
+    }
+    {
+        Builder* b = weft_builder();
+        weft_store_32(b,1, weft_add_i32(b, weft_load_32(b,0), weft_splat_32(b,-1)));
+        assert(weft_emit_c(b, "add", f));
+        free(weft_compile(b));
+    }
+    const long len = ftell(f);
+    assert(len > 0);
+    {
+        // No C template for exp_f32, so nothing is written.
+        Builder* b = weft_builder();
+        weft_store_32(b,1, weft_exp_f32(b, weft_load_32(b,0)));
+        assert(!weft_emit_c(b, "exp", f));
+        free(weft_compile(b));
+    }
+    assert(ftell(f) == len);
+
+    char src[4096] = {0};
+    rewind(f);
+    assert(fread(src, 1, sizeof src - 1, f) == (size_t)len);
+    assert(strstr(src, "void add(int64_t n, void* const ptr[]) {"));
+    assert(strstr(src, "const uint32_t v1 = (uint32_t)(-1);"));
+    assert(strstr(src, "const uint32_t v3 = (uint32_t)(v1 + v2);"));
+    fclose(f);
+}
+
+static void test_dump(void) {
+    FILE* f = tmpfile();
+    if (!f) {
+        return;
+    }
+    Builder* b = weft_builder();
+    {
+        V32 x = weft_load_32(b,0),
+            k = weft_mul_f32(b, weft_uniform_32(b,2), weft_splat_32(b,0x40000000));
+        (void)weft_add_i32(b, x,x);
+        weft_store_32(b,1, weft_scan_add_32(b, weft_add_f32(b, x,k)));
+        weft_store_16(b,3, weft_narrow_f32(b, weft_sqrt_f32(b,x)));
+        weft_store_64(b,4, weft_mul_wide_u32(b, x, weft_popcnt_32(b,x)));
+    }
+    weft_dump_builder(b, f);
+    Program* p = weft_compile(b);
+    weft_dump_program(p, f);
+    free(p);
+
+    b = weft_builder();
+    weft_store_32(b,1, weft_not_32(b, weft_load_32(b,0)));
+    p = weft_compile(b);
+    weft_dump_program(p, f);
+    free(p);
+
+    char text[4096] = {0};
+    rewind(f);
+    assert(fread(text, 1, sizeof text - 1, f) > 0);
+    fclose(f);
+
+    assert(strstr(text, "v3 =    uniform_32 imm=2"));
+    assert(strstr(text, "v4 =    mul_f32 v2 v3"));
+    assert(strstr(text, "v5 =    add_i32 v1 v1"));
+    assert(strstr(text, "; 4B, dead\n"));
+    assert(strstr(text, "; 4B, invariant\n"));
+    assert(strstr(text, "v13 =   mul_wide_u32 v1 v12"));
+    assert(strstr(text, "; 8B\n"));
+    assert(strstr(text, "; 14 insts, 13 live, 3 invariant, ~"));
+
+    // The three invariant values hoist into the first 96 bytes of scratch.
+    assert(strstr(text, "   2  [64] =    mul_f32 [0] [32]"));
+    assert(strstr(text, "loop:\n   3  [96] =    load_32 imm=0"));
+    assert(strstr(text, "scan totals:\n"));
+    assert(strstr(text, "state 0 at ["));
+    assert(strstr(text, "store_64_done [272] imm=4"));
+    assert(strstr(text, "; 13 insts, 3 invariant, 344 bytes of scratch, ~"));
+    assert(strstr(text, "[32] =    not_32 [0] "));
+    assert(!strstr(text, "?"));
+}
+
+static void test_mul_wide(void) {
+    enum { N = 1<<16 };
+    int8_t   *x8 = malloc(N * sizeof *x8), *y8 = malloc(N * sizeof *y8);
+    int16_t  *x16 = malloc(N * sizeof *x16), *y16 = malloc(N * sizeof *y16),
+             *ws8 = malloc(N * sizeof *ws8), *wu8 = malloc(N * sizeof *wu8);
+    int8_t   *hs8 = malloc(N * sizeof *hs8), *hu8 = malloc(N * sizeof *hu8);
+    int32_t  *ws16 = malloc(N * sizeof *ws16), *wu16 = malloc(N * sizeof *wu16);
+    int16_t  *hs16 = malloc(N * sizeof *hs16), *hu16 = malloc(N * sizeof *hu16);
+    uint32_t *x32 = malloc(N * sizeof *x32), *y32 = malloc(N * sizeof *y32),
+             *acc = malloc(N * sizeof *acc),
+             *ds16 = malloc(N * sizeof *ds16), *du8s8 = malloc(N * sizeof *du8s8);
+    for (int i = 0; i < N; i++) {
+        x8 [i] = (int8_t)i;
+        y8 [i] = (int8_t)(i >> 8);
+        x16[i] = (int16_t)(i * 0x9e37);
+        y16[i] = (int16_t)(i ^ 0x8000);
+        x32[i] = (uint32_t)i * 0x9e3779b9u;
+        y32[i] = (uint32_t)i * 0x85ebca6bu ^ (i & 1 ? 0x80808080u : 0);
+        acc[i] = (uint32_t)i * 0xc2b2ae35u;
+    }
+    x32[0] = y32[0] = 0x80008000u;
+    x32[1] = 0xffffffffu;
+    y32[1] = 0x80808080u;
+
+    Builder* b = weft_builder();
+    V8  X8  = weft_load_8 (b, 0), Y8  = weft_load_8 (b, 1);
+    V16 X16 = weft_load_16(b, 2), Y16 = weft_load_16(b, 3);
+    V32 X32 = weft_load_32(b, 4), Y32 = weft_load_32(b, 5), A = weft_load_32(b, 6);
+    weft_store_16(b, 7, weft_mul_wide_s8 (b, X8 , Y8 ));
+    weft_store_16(b, 8, weft_mul_wide_u8 (b, X8 , Y8 ));
+    weft_store_8 (b, 9, weft_mulhi_s8    (b, X8 , Y8 ));
+    weft_store_8 (b,10, weft_mulhi_u8    (b, X8 , Y8 ));
+    weft_store_32(b,11, weft_mul_wide_s16(b, X16, Y16));
+    weft_store_32(b,12, weft_mul_wide_u16(b, X16, Y16));
+    weft_store_16(b,13, weft_mulhi_s16   (b, X16, Y16));
+    weft_store_16(b,14, weft_mulhi_u16   (b, X16, Y16));
+    weft_store_32(b,15, weft_dot_s16 (b, X32, Y32, A));
+    weft_store_32(b,16, weft_dot_u8s8(b, X32, Y32, A));
+    Program* p = weft_compile(b);
+    weft_run(p, N, (void*[]){x8,y8,x16,y16,x32,y32,acc,
+                             ws8,wu8,hs8,hu8,ws16,wu16,hs16,hu16,ds16,du8s8});
+    free(p);
+
+    for (int i = 0; i < N; i++) {
+        const int s8 = x8[i] * y8[i],
+                  u8 = (uint8_t)x8[i] * (uint8_t)y8[i];
+        assert(ws8[i] == (int16_t)s8 && wu8[i] == (int16_t)u8);
+        assert(hs8[i] == (int8_t)(s8 >> 8) && hu8[i] == (int8_t)(u8 >> 8));
+
+        const int32_t  s16 = x16[i] * y16[i];
+        const uint32_t u16 = (uint32_t)(uint16_t)x16[i] * (uint16_t)y16[i];
+        assert(ws16[i] == s16 && wu16[i] == (int32_t)u16);
+        assert(hs16[i] == (int16_t)(s16 >> 16) && hu16[i] == (int16_t)(u16 >> 16));
+
+        int64_t s = 0, u = 0;
+        for (int k = 0; k < 32; k += 16) {
+            s += (int16_t)(x32[i] >> k) * (int16_t)(y32[i] >> k);
+        }
+        for (int k = 0; k < 32; k += 8) {
+            u += (uint8_t)(x32[i] >> k) * (int8_t)(y32[i] >> k);
+        }
+        assert(ds16 [i] == (uint32_t)(acc[i] + (uint64_t)s));
+        assert(du8s8[i] == (uint32_t)(acc[i] + (uint64_t)u));
+    }
+
+    free(x8); free(y8); free(x16); free(y16); free(ws8); free(wu8); free(hs8); free(hu8);
+    free(ws16); free(wu16); free(hs16); free(hu16);
+    free(x32); free(y32); free(acc); free(ds16); free(du8s8);
+}
+
 static void test(size_t (*fn)(Builder*)) {
     Builder* b = weft_builder();
     size_t bits = fn(b);
@@ -265,6 +1633,10 @@ static size_t roundtrip_f64(Builder* b) {
     return store_64(b,0, weft_cast_s64(b, weft_cast_f64(b, weft_load_64(b,1))));
 }
 
+static size_t roundtrip_bf16(Builder* b) {
+    return store_32(b,0, weft_widen_bf16(b, weft_narrow_bf16(b, weft_load_32(b,1))));
+}
+
 static size_t arithmetic_f16(Builder* b) {
     V16 one = weft_uniform_16(b, 3);
 
@@ -1006,6 +2378,20 @@ static size_t comparisons_f64(Builder* b) {
     return store_64(b,0,x);
 }
 
+static size_t mul_wide_peepholes(Builder* b) {
+    V16 x = weft_load_16(b,1);
+    V32 w = weft_mul_wide_u16(b, x, weft_splat_16(b,1)),
+        z = weft_mul_wide_s16(b, weft_splat_16(b,0), x),
+        d = weft_dot_s16(b, weft_widen_u16(b,x), weft_splat_32(b,0), z);
+    return store_16(b,0, weft_narrow_i32(b, weft_add_i32(b, w, d)));
+}
+static size_t bit_peepholes(Builder* b) {
+    V32 x = weft_load_32(b,1),
+        y = weft_rotr_32(b, weft_rotl_32(b, x, weft_splat_32(b,32)), weft_splat_32(b,-64)),
+        z = weft_bswap_32(b, weft_bswap_32(b, y));
+    return store_32(b,0, weft_rotl_32(b, weft_rotr_32(b, z, weft_splat_32(b,7)),
+                                         weft_splat_32(b,39)));
+}
 static size_t narrow_widen_i8(Builder* b) {
     V8 x = weft_load_8(b,1),
        s = weft_narrow_i16(b, weft_widen_s8(b,x)),
@@ -1033,6 +2419,346 @@ static size_t narrow_widen_f32(Builder* b) {
     return store_32(b,0, weft_narrow_f64(b, weft_widen_f32(b,x)));
 }
 
+static size_t min_max_i8(Builder* b) {
+    V8 x = weft_load_8(b,1),
+        y = weft_load_8(b,1);
+
+    V8 zero = weft_splat_8(b, 0),
+        T    = weft_splat_8(b,-1),
+        lo   = weft_splat_8(b,INT8_MIN),
+        hi   = weft_splat_8(b,INT8_MAX);
+
+    assert(   x.id == weft_min_s8(b,x,x   ).id);
+    assert(  lo.id == weft_min_s8(b,x,lo  ).id);
+    assert(   x.id == weft_min_s8(b,hi,x  ).id);
+    assert(   x.id == weft_max_s8(b,lo,x  ).id);
+    assert(  hi.id == weft_max_s8(b,x,hi  ).id);
+    assert(zero.id == weft_min_u8(b,x,zero).id);
+    assert(   x.id == weft_min_u8(b,T,x   ).id);
+    assert(   x.id == weft_max_u8(b,zero,x).id);
+    assert(   T.id == weft_max_u8(b,x,T   ).id);
+    assert(x.id == weft_avg_u8(b,x,x).id);
+
+    assert(weft_min_s8(b,x,y).id == weft_min_s8(b,y,x).id);
+    assert(weft_abs_s8(b,x).id == weft_abs_s8(b, weft_abs_s8(b,x)).id);
+    assert(weft_splat_8(b,3).id == weft_abs_s8(b, weft_splat_8(b,-3)).id);
+    assert(weft_splat_8(b,-3).id == weft_min_s8(b, weft_splat_8(b,-3), weft_splat_8(b,5)).id);
+    assert(weft_splat_8(b, 5).id == weft_min_u8(b, weft_splat_8(b,-3), weft_splat_8(b,5)).id);
+
+    x = weft_min_s8(b,x, weft_splat_8(b,8));
+    x = weft_max_s8(b,x, weft_splat_8(b,-1));
+    x = weft_min_u8(b,x, weft_splat_8(b,-1 ^ 0x7f));
+    x = weft_max_u8(b,x, y);
+    x = weft_abs_s8(b, weft_sub_i8(b, zero, x));
+    x = weft_avg_u8(b,x,y);
+
+    return store_8(b,0,x);
+}
+static size_t min_max_i16(Builder* b) {
+    V16 x = weft_load_16(b,1),
+        y = weft_load_16(b,1);
+
+    V16 zero = weft_splat_16(b, 0),
+        T    = weft_splat_16(b,-1),
+        lo   = weft_splat_16(b,INT16_MIN),
+        hi   = weft_splat_16(b,INT16_MAX);
+
+    assert(   x.id == weft_min_s16(b,x,x   ).id);
+    assert(  lo.id == weft_min_s16(b,x,lo  ).id);
+    assert(   x.id == weft_min_s16(b,hi,x  ).id);
+    assert(   x.id == weft_max_s16(b,lo,x  ).id);
+    assert(  hi.id == weft_max_s16(b,x,hi  ).id);
+    assert(zero.id == weft_min_u16(b,x,zero).id);
+    assert(   x.id == weft_min_u16(b,T,x   ).id);
+    assert(   x.id == weft_max_u16(b,zero,x).id);
+    assert(   T.id == weft_max_u16(b,x,T   ).id);
+    assert(x.id == weft_avg_u16(b,x,x).id);
+
+    assert(weft_min_s16(b,x,y).id == weft_min_s16(b,y,x).id);
+    assert(weft_abs_s16(b,x).id == weft_abs_s16(b, weft_abs_s16(b,x)).id);
+    assert(weft_splat_16(b,3).id == weft_abs_s16(b, weft_splat_16(b,-3)).id);
+    assert(weft_splat_16(b,-3).id == weft_min_s16(b, weft_splat_16(b,-3), weft_splat_16(b,5)).id);
+    assert(weft_splat_16(b, 5).id == weft_min_u16(b, weft_splat_16(b,-3), weft_splat_16(b,5)).id);
+
+    x = weft_min_s16(b,x, weft_splat_16(b,8));
+    x = weft_max_s16(b,x, weft_splat_16(b,-1));
+    x = weft_min_u16(b,x, weft_splat_16(b,-1 ^ 0x7f));
+    x = weft_max_u16(b,x, y);
+    x = weft_abs_s16(b, weft_sub_i16(b, zero, x));
+    x = weft_avg_u16(b,x,y);
+
+    return store_16(b,0,x);
+}
+static size_t min_max_i32(Builder* b) {
+    V32 x = weft_load_32(b,1),
+        y = weft_load_32(b,1);
+
+    V32 zero = weft_splat_32(b, 0),
+        T    = weft_splat_32(b,-1),
+        lo   = weft_splat_32(b,INT32_MIN),
+        hi   = weft_splat_32(b,INT32_MAX);
+
+    assert(   x.id == weft_min_s32(b,x,x   ).id);
+    assert(  lo.id == weft_min_s32(b,x,lo  ).id);
+    assert(   x.id == weft_min_s32(b,hi,x  ).id);
+    assert(   x.id == weft_max_s32(b,lo,x  ).id);
+    assert(  hi.id == weft_max_s32(b,x,hi  ).id);
+    assert(zero.id == weft_min_u32(b,x,zero).id);
+    assert(   x.id == weft_min_u32(b,T,x   ).id);
+    assert(   x.id == weft_max_u32(b,zero,x).id);
+    assert(   T.id == weft_max_u32(b,x,T   ).id);
+
+    assert(weft_min_s32(b,x,y).id == weft_min_s32(b,y,x).id);
+    assert(weft_abs_s32(b,x).id == weft_abs_s32(b, weft_abs_s32(b,x)).id);
+    assert(weft_splat_32(b,3).id == weft_abs_s32(b, weft_splat_32(b,-3)).id);
+    assert(weft_splat_32(b,-3).id == weft_min_s32(b, weft_splat_32(b,-3), weft_splat_32(b,5)).id);
+    assert(weft_splat_32(b, 5).id == weft_min_u32(b, weft_splat_32(b,-3), weft_splat_32(b,5)).id);
+
+    x = weft_min_s32(b,x, weft_splat_32(b,8));
+    x = weft_max_s32(b,x, weft_splat_32(b,-1));
+    x = weft_min_u32(b,x, weft_splat_32(b,-1 ^ 0x7f));
+    x = weft_max_u32(b,x, y);
+    x = weft_abs_s32(b, weft_sub_i32(b, zero, x));
+
+    return store_32(b,0,x);
+}
+static size_t min_max_i64(Builder* b) {
+    V64 x = weft_load_64(b,1),
+        y = weft_load_64(b,1);
+
+    V64 zero = weft_splat_64(b, 0),
+        T    = weft_splat_64(b,-1),
+        lo   = weft_splat_64(b,INT64_MIN),
+        hi   = weft_splat_64(b,INT64_MAX);
+
+    assert(   x.id == weft_min_s64(b,x,x   ).id);
+    assert(  lo.id == weft_min_s64(b,x,lo  ).id);
+    assert(   x.id == weft_min_s64(b,hi,x  ).id);
+    assert(   x.id == weft_max_s64(b,lo,x  ).id);
+    assert(  hi.id == weft_max_s64(b,x,hi  ).id);
+    assert(zero.id == weft_min_u64(b,x,zero).id);
+    assert(   x.id == weft_min_u64(b,T,x   ).id);
+    assert(   x.id == weft_max_u64(b,zero,x).id);
+    assert(   T.id == weft_max_u64(b,x,T   ).id);
+
+    assert(weft_min_s64(b,x,y).id == weft_min_s64(b,y,x).id);
+    assert(weft_abs_s64(b,x).id == weft_abs_s64(b, weft_abs_s64(b,x)).id);
+    assert(weft_splat_64(b,3).id == weft_abs_s64(b, weft_splat_64(b,-3)).id);
+    assert(weft_splat_64(b,-3).id == weft_min_s64(b, weft_splat_64(b,-3), weft_splat_64(b,5)).id);
+    assert(weft_splat_64(b, 5).id == weft_min_u64(b, weft_splat_64(b,-3), weft_splat_64(b,5)).id);
+
+    x = weft_min_s64(b,x, weft_splat_64(b,8));
+    x = weft_max_s64(b,x, weft_splat_64(b,-1));
+    x = weft_min_u64(b,x, weft_splat_64(b,-1 ^ 0x7f));
+    x = weft_max_u64(b,x, y);
+    x = weft_abs_s64(b, weft_sub_i64(b, zero, x));
+
+    return store_64(b,0,x);
+}
+static size_t min_max_f16(Builder* b) {
+    V16 x = weft_load_16(b,1),
+        y = weft_load_16(b,1);
+
+    union { __fp16 f; int16_t bits; } eight = {8.0}, neg = {-1.0};
+    V16 nan = weft_splat_16(b, 0x7e00);
+
+    assert(x.id == weft_min_f16(b,x,x).id);
+    assert(x.id == weft_max_f16(b,x,x).id);
+    assert(weft_min_f16(b,x,y).id == weft_min_f16(b,y,x).id);
+    assert(weft_abs_f16(b,x).id == weft_abs_f16(b, weft_abs_f16(b,x)).id);
+
+    x = weft_min_f16(b,x, weft_splat_16(b, eight.bits));
+    x = weft_max_f16(b,x, weft_splat_16(b, neg.bits));
+    x = weft_min_f16(b,x, nan);
+    x = weft_max_f16(b,nan, x);
+    x = weft_max_f16(b,x, y);
+    x = weft_abs_f16(b, weft_xor_16(b, x, weft_splat_16(b, INT16_MIN)));
+
+    return store_16(b,0,x);
+}
+static size_t min_max_f32(Builder* b) {
+    V32 x = weft_load_32(b,1),
+        y = weft_load_32(b,1);
+
+    union { float f; int32_t bits; } eight = {8.0}, neg = {-1.0};
+    V32 nan = weft_splat_32(b, 0x7fc00000);
+
+    assert(x.id == weft_min_f32(b,x,x).id);
+    assert(x.id == weft_max_f32(b,x,x).id);
+    assert(weft_min_f32(b,x,y).id == weft_min_f32(b,y,x).id);
+    assert(weft_abs_f32(b,x).id == weft_abs_f32(b, weft_abs_f32(b,x)).id);
+
+    x = weft_min_f32(b,x, weft_splat_32(b, eight.bits));
+    x = weft_max_f32(b,x, weft_splat_32(b, neg.bits));
+    x = weft_min_f32(b,x, nan);
+    x = weft_max_f32(b,nan, x);
+    x = weft_max_f32(b,x, y);
+    x = weft_abs_f32(b, weft_xor_32(b, x, weft_splat_32(b, INT32_MIN)));
+
+    return store_32(b,0,x);
+}
+static size_t min_max_f64(Builder* b) {
+    V64 x = weft_load_64(b,1),
+        y = weft_load_64(b,1);
+
+    union { double f; int64_t bits; } eight = {8.0}, neg = {-1.0};
+    V64 nan = weft_splat_64(b, 0x7ff8000000000000);
+
+    assert(x.id == weft_min_f64(b,x,x).id);
+    assert(x.id == weft_max_f64(b,x,x).id);
+    assert(weft_min_f64(b,x,y).id == weft_min_f64(b,y,x).id);
+    assert(weft_abs_f64(b,x).id == weft_abs_f64(b, weft_abs_f64(b,x)).id);
+
+    x = weft_min_f64(b,x, weft_splat_64(b, eight.bits));
+    x = weft_max_f64(b,x, weft_splat_64(b, neg.bits));
+    x = weft_min_f64(b,x, nan);
+    x = weft_max_f64(b,nan, x);
+    x = weft_max_f64(b,x, y);
+    x = weft_abs_f64(b, weft_xor_64(b, x, weft_splat_64(b, INT64_MIN)));
+
+    return store_64(b,0,x);
+}
+
+static size_t transcendental_f16(Builder* b) {
+    V16 x    = weft_load_16(b,1),
+        zero = weft_splat_16(b,0),
+        one  = weft_splat_16(b,0x3c00),
+        half = weft_splat_16(b,0x3800);
+
+    assert( one.id == weft_exp_f16(b,zero).id);
+    assert(zero.id == weft_log_f16(b,one ).id);
+    assert(zero.id == weft_sin_f16(b,zero).id);
+    assert( one.id == weft_cos_f16(b,zero).id);
+    assert( one.id == weft_pow_f16(b,x,zero).id);
+    assert(   x.id == weft_pow_f16(b,x,one ).id);
+
+    // Each of these should land close enough to x that rounding recovers it exactly.
+    V16 e = weft_exp_f16(b, weft_log_f16(b,x)),
+        s = weft_sin_f16(b,x),
+        c = weft_cos_f16(b,x),
+        p = weft_pow_f16(b,x, weft_uniform_16(b,3));
+    x = weft_mul_f16(b,x, weft_add_f16(b, weft_mul_f16(b,s,s), weft_mul_f16(b,c,c)));
+    x = weft_floor_f16(b, weft_add_f16(b,x,half));
+    e = weft_floor_f16(b, weft_add_f16(b,e,half));
+    p = weft_floor_f16(b, weft_add_f16(b,p,half));
+    weft_assert_16(b, weft_eq_f16(b,x,e));
+    weft_assert_16(b, weft_eq_f16(b,x,p));
+
+    return store_16(b,0,x);
+}
+static size_t transcendental_f32(Builder* b) {
+    V32 x    = weft_load_32(b,1),
+        zero = weft_splat_32(b,0),
+        one  = weft_splat_32(b,0x3f800000),
+        half = weft_splat_32(b,0x3f000000);
+
+    assert( one.id == weft_exp_f32(b,zero).id);
+    assert(zero.id == weft_log_f32(b,one ).id);
+    assert(zero.id == weft_sin_f32(b,zero).id);
+    assert( one.id == weft_cos_f32(b,zero).id);
+    assert( one.id == weft_pow_f32(b,x,zero).id);
+    assert(   x.id == weft_pow_f32(b,x,one ).id);
+
+    // Each of these should land close enough to x that rounding recovers it exactly.
+    V32 e = weft_exp_f32(b, weft_log_f32(b,x)),
+        s = weft_sin_f32(b,x),
+        c = weft_cos_f32(b,x),
+        p = weft_pow_f32(b,x, weft_uniform_32(b,4));
+    x = weft_mul_f32(b,x, weft_add_f32(b, weft_mul_f32(b,s,s), weft_mul_f32(b,c,c)));
+    x = weft_floor_f32(b, weft_add_f32(b,x,half));
+    e = weft_floor_f32(b, weft_add_f32(b,e,half));
+    p = weft_floor_f32(b, weft_add_f32(b,p,half));
+    weft_assert_32(b, weft_eq_f32(b,x,e));
+    weft_assert_32(b, weft_eq_f32(b,x,p));
+
+    return store_32(b,0,x);
+}
+static size_t transcendental_f64(Builder* b) {
+    V64 x    = weft_load_64(b,1),
+        zero = weft_splat_64(b,0),
+        one  = weft_splat_64(b,0x3ff0000000000000),
+        half = weft_splat_64(b,0x3fe0000000000000);
+
+    assert( one.id == weft_exp_f64(b,zero).id);
+    assert(zero.id == weft_log_f64(b,one ).id);
+    assert(zero.id == weft_sin_f64(b,zero).id);
+    assert( one.id == weft_cos_f64(b,zero).id);
+    assert( one.id == weft_pow_f64(b,x,zero).id);
+    assert(   x.id == weft_pow_f64(b,x,one ).id);
+
+    // Each of these should land close enough to x that rounding recovers it exactly.
+    V64 e = weft_exp_f64(b, weft_log_f64(b,x)),
+        s = weft_sin_f64(b,x),
+        c = weft_cos_f64(b,x),
+        p = weft_pow_f64(b,x, weft_uniform_64(b,5));
+    x = weft_mul_f64(b,x, weft_add_f64(b, weft_mul_f64(b,s,s), weft_mul_f64(b,c,c)));
+    x = weft_floor_f64(b, weft_add_f64(b,x,half));
+    e = weft_floor_f64(b, weft_add_f64(b,e,half));
+    p = weft_floor_f64(b, weft_add_f64(b,p,half));
+    weft_assert_64(b, weft_eq_f64(b,x,e));
+    weft_assert_64(b, weft_eq_f64(b,x,p));
+
+    return store_64(b,0,x);
+}
+
+static size_t approx_f16(Builder* b) {
+    V16 x    = weft_load_16(b,1),
+        half = weft_splat_16(b,0x3800);
+
+    assert(weft_rcp_approx_f16(b,x,1).id != weft_rcp_approx_f16(b,x,2).id);
+
+    V16 s = weft_rsqrt_approx_f16(b,x,1);
+    x = weft_rcp_approx_f16(b, weft_rcp_approx_f16(b,x,1), 1);
+    x = weft_floor_f16(b, weft_add_f16(b,x,half));
+
+    V16 y = weft_rcp_approx_f16(b, weft_mul_f16(b,s,s), 1);
+    y = weft_floor_f16(b, weft_add_f16(b,y,half));
+    weft_assert_16(b, weft_eq_f16(b,x,y));
+
+    return store_16(b,0,x);
+}
+static size_t approx_f32(Builder* b) {
+    V32 x    = weft_load_32(b,1),
+        half = weft_splat_32(b,0x3f000000);
+
+    assert(weft_rcp_approx_f32(b,x,1).id != weft_rcp_approx_f32(b,x,2).id);
+
+    V32 s = weft_rsqrt_approx_f32(b,x,2);
+    x = weft_rcp_approx_f32(b, weft_rcp_approx_f32(b,x,2), 2);
+    x = weft_floor_f32(b, weft_add_f32(b,x,half));
+
+    V32 y = weft_rcp_approx_f32(b, weft_mul_f32(b,s,s), 2);
+    y = weft_floor_f32(b, weft_add_f32(b,y,half));
+    weft_assert_32(b, weft_eq_f32(b,x,y));
+
+    return store_32(b,0,x);
+}
+
+static size_t shuffle_peepholes(Builder* b) {
+    V32 x = weft_load_32(b,1);
+
+    assert(x.id == weft_shuffle_32(b,x, 0x03020100).id);
+    assert(x.id == weft_shuffle_32(b, weft_shuffle_32(b,x, 0x00010203), 0x00010203).id);
+    assert(x.id == weft_shuffle_32(b, weft_shuffle_32(b,x, 0x00030201), 0x02010003).id);
+    assert(weft_splat_32(b,0).id == weft_shuffle_32(b,x, 0x80ff0407).id);
+    assert(weft_shuffle_32(b,x, 0x80000000).id == weft_shuffle_32(b,x, 0x7f000000).id);
+    assert(weft_splat_32(b,0x0c0c0c0c).id == weft_shuffle_32(b, weft_splat_32(b,0x0c0b0a09)
+                                                                 , 0x03030303).id);
+
+    V32 s8  = weft_splat_32(b, 8),
+        s24 = weft_splat_32(b,24),
+        lo  = weft_and_32(b,x, weft_splat_32(b,0x000000ff)),
+        mid = weft_and_32(b,x, weft_splat_32(b,0x0000ff00)),
+        bswap = weft_or_32(b, weft_or_32(b, weft_shl_i32(b,lo ,s24)
+                                          , weft_shl_i32(b,mid,s8 ))
+                            , weft_or_32(b, weft_and_32(b, weft_shr_u32(b,x,s8)
+                                                         , weft_splat_32(b,0x0000ff00))
+                                          , weft_shr_u32(b,x,s24)));
+    weft_assert_32(b, weft_eq_i32(b, bswap, weft_shuffle_32(b,x, 0x00010203)));
+
+    return store_32(b,0,x);
+}
+
 static size_t ternary_constant_prop(Builder* b) {
     V32 x = weft_load_32(b,1);
 
@@ -1165,6 +2891,45 @@ int main(int argc, char** argv) {
     test_memset64();
 
     test_no_tail();
+    test_transcendental_accuracy();
+    test_rcp_rsqrt_accuracy();
+    test_f16_bit_exact();
+    test_bf16_bit_exact();
+    test_lut16();
+    test_lut32();
+    test_shuffle();
+    test_mul_wide();
+    test_round_cvt();
+    test_bits_8();
+    test_bits_16();
+    test_bits_32();
+    test_bits_64();
+    test_bswap();
+    test_index();
+    test_load_strided();
+    test_if_any();
+    test_store_masked_8();
+    test_store_masked_16();
+    test_store_masked_32();
+    test_store_masked_64();
+    test_store_compress_8();
+    test_store_compress_16();
+    test_store_compress_32();
+    test_store_compress_64();
+    test_scan_8();
+    test_scan_16();
+    test_scan_32();
+    test_scan_64();
+    test_histogram();
+    test_run_batch();
+    test_run_2d();
+    test_stream();
+    test_stream_strided();
+    test_run_files();
+    test_nontemporal_stores();
+    test_prefetch();
+    test_emit_c();
+    test_dump();
 
     test(memcpy8);
     test(memcpy16);
@@ -1189,6 +2954,7 @@ int main(int argc, char** argv) {
     test(roundtrip_f16);
     test(roundtrip_f32);
     test(roundtrip_f64);
+    test(roundtrip_bf16);
 
     test(arithmetic_f16);
     test(arithmetic_f32);
@@ -1251,6 +3017,25 @@ int main(int argc, char** argv) {
     test(narrow_widen_i32);
     test(narrow_widen_f16);
     test(narrow_widen_f32);
+    test(mul_wide_peepholes);
+    test(bit_peepholes);
+
+    test(min_max_i8);
+    test(min_max_i16);
+    test(min_max_i32);
+    test(min_max_i64);
+    test(min_max_f16);
+    test(min_max_f32);
+    test(min_max_f64);
+
+    test(transcendental_f16);
+    test(transcendental_f32);
+    test(transcendental_f64);
+
+    test(approx_f16);
+    test(approx_f32);
+
+    test(shuffle_peepholes);
 
     test(ternary_constant_prop);
     test(ternary_not_constant_prop);
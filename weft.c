@@ -1,9 +1,24 @@
+#if !defined(__wasm__) && !defined(_POSIX_C_SOURCE)
+    #define _POSIX_C_SOURCE 200809L  // For posix_madvise() and ftruncate() under -std=c99.
+#endif
 #include "weft.h"
 #include <assert.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include <tgmath.h>
+#if !defined(__wasm__)
+    #include <fcntl.h>
+    #include <pthread.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+#if defined(__SSE__)
+    #include <immintrin.h>
+#elif defined(__ARM_NEON)
+    #include <arm_neon.h>
+#endif
 
 // TODO: test GCC with -march=armv8.2-a+fp16
 
@@ -15,7 +30,7 @@ typedef weft_V32 V32;
 typedef weft_V64 V64;
 
 typedef struct PInst {
-    void (*fn)(const struct PInst*, int, unsigned, void*, void*, void* const ptr[]);
+    void (*fn)(const struct PInst*, int64_t, unsigned, void*, void*, void* const ptr[]);
     int x,y,z;
     int : (sizeof(void*) == 8 ? 32 : 0);
     int64_t imm;
@@ -23,9 +38,23 @@ typedef struct PInst {
 
 typedef struct weft_Program {
     int   slots;
-    int   unused;
+    int   states;          // Scans, histograms and rows keep 64 bits of state after the slots.
     int   loop_inst;
     int   loop_slot;
+    int   scan_inst;       // Just what scans and compressing stores' counts need, for
+                           // weft_run_parallel()'s first pass, or 0.
+    int   scan_loop_inst;
+    int   scan_loop_slot;
+    int   state_inst;      // p->inst[state_inst+k] is the portable fn and imm using state k.
+    int   serial;          // Scans of scanned values and compressing stores inside weft_if_any_*()
+                           // regions can't be totaled independently per thread.
+    int   ptrs;
+    int   ptr_inst;        // p->inst[ptr_inst+i].imm is ptr[i]'s bytes per instance, x if stored,
+                           // y if loaded, and z its element size, or -1 if used with two strides.
+    int   nontemp_inst;    // A copy of the program with non-temporal stores, or 0.
+    int64_t nontemp_n;     // Runs of at least this many instances use that copy.
+    int64_t prefetch_n;    // Runs of at least this many instances prefetch each loaded pointer
+    int64_t prefetch_dist; // this many instances ahead.
     PInst inst[];
 } Program;
 
@@ -34,10 +63,11 @@ typedef struct {
     int x,y,z;  // All BInst/Builder value IDs are 1-indexed so 0 can mean unused, N/A, etc.
     enum { MATH, SPLAT, UNIFORM, LOAD, SIDE_EFFECT } kind : 16;
     int slots                                             : 16;
-    void  (*fn  )(const PInst*, int, unsigned, void*, void*, void* const ptr[]);
-    void  (*done)(const PInst*, int, unsigned, void*, void*, void* const ptr[]);
+    void  (*fn  )(const PInst*, int64_t, unsigned, void*, void*, void* const ptr[]);
+    void  (*done)(const PInst*, int64_t, unsigned, void*, void*, void* const ptr[]);
     char* (*jit )(char*, int[], int[], int[], int[], int64_t);
-    void*         unused;
+    int           region;  // The innermost weft_if_any_*() this inst was built under, or 0.
+    int           unused;
 } BInst;
 
 typedef struct weft_Builder {
@@ -47,6 +77,10 @@ typedef struct weft_Builder {
     struct {int id,hash;} *cse;
     int                    cse_len;
     int                    cse_cap;
+    int                    region;
+    int                    ptrs;    // One past the highest ptr index any inst uses.
+    int64_t                nontemp_n;
+    int64_t                prefetch_dist;
 } Builder;
 
 Builder* weft_builder(void) {
@@ -92,7 +126,7 @@ static void insert_cse(Builder* b, int id, int hash) {
 // Argument x starts at v(x); ditto for y,z.
 // off tracks weft_run()'s progress [0,n), for offseting varying pointers.
 // When operating on full N-sized chunks, tail is 0; tail is k for the final k<N sized chunk.
-#define stage(name) static void name(const PInst* inst, int off, unsigned tail, \
+#define stage(name) static void name(const PInst* inst, int64_t off, unsigned tail, \
                                      void* restrict V, void* restrict R, void* const ptr[])
 #define each    for (int i = 0; i < N; i++)
 #define next(R) inst[1].fn(inst+1,off,tail,V,R,ptr); return
@@ -148,7 +182,25 @@ static int constant_prop(Builder* b, const BInst* inst) {
     return 0;
 }
 
+// Can the current region see value id, i.e. was it built in this region or one enclosing it?
+static bool visible(const Builder* b, int id) {
+    for (int r = b->region;; r = b->inst[r-1].region) {
+        if (b->inst[id-1].region == r) {
+            return true;
+        }
+        if (r == 0) {
+            return false;
+        }
+    }
+}
+
 static int inst_(Builder* b, BInst inst) {
+    assert(!inst.x || visible(b, inst.x));
+    assert(!inst.y || visible(b, inst.y));
+    assert(!inst.z || visible(b, inst.z));
+    // Splats and uniforms are always hoisted out of the loop and computed unconditionally.
+    inst.region = (inst.kind == SPLAT || inst.kind == UNIFORM) ? 0 : b->region;
+
     const int hash = (int)fnv1a(&inst, sizeof(inst));
 
     for (int id = lookup_cse(b, hash, &inst); id;) {
@@ -186,60 +238,719 @@ static int inst_(Builder* b, BInst inst) {
 }
 #define inst(b,k,bits,f,...) (V##bits){inst_(b,(BInst){.kind=k, .slots=bits/8, .fn=f, __VA_ARGS__})}
 
-void weft_run(const weft_Program* p, int n, void* const ptr[]) {
-    void* V = malloc(N * (size_t)p->slots);
+static int use_ptr(Builder* b, int ptr) {
+    b->ptrs = b->ptrs > ptr+1 ? b->ptrs : ptr+1;
+    return ptr;
+}
+
+typedef void Stage(const PInst*, int64_t, unsigned, void*, void*, void* const ptr[]);
+
+static void nontemporal_fence(void);
+
+static void prefetch(const Program* p, int64_t off, void* const ptr[]) {
+    for (int i = 0; i < p->ptrs; i++) {
+        const PInst info = p->inst[p->ptr_inst + i];
+        if (info.y && info.z > 0 && info.imm > 0) {
+            const char* ahead = (const char*)ptr[i] + off * info.imm;
+            for (int64_t b = 0; b < N * info.imm; b += 64) {
+                __builtin_prefetch(ahead + b);
+            }
+        }
+    }
+}
+
+// Count runs that took the non-temporal copy of their program and runs that prefetched, for tests.
+extern int64_t weft_nontemporal_runs, weft_prefetch_runs;
+int64_t weft_nontemporal_runs = 0,
+        weft_prefetch_runs    = 0;
 
-    void* R = V;
-    const PInst* inst = p->inst;
+// Run instances [off,n) starting at p->inst[entry], looping back to p->inst[loop_inst].  Callers
+// splitting a run into windows, rows or pushes pass the length of the whole as len, so a long
+// run is treated as long however it's split.
+static void run(const Program* p, int entry, int loop_inst, int loop_slot,
+                int64_t off, int64_t n, int64_t len, void* V, void* const ptr[]) {
+    // Long runs of the main program switch over to its copy with non-temporal stores.
+    const bool nontemporal = p->nontemp_inst && loop_inst == p->loop_inst
+                          && len >= p->nontemp_n;
+    if (nontemporal) {
+        __atomic_fetch_add(&weft_nontemporal_runs, 1, __ATOMIC_RELAXED);
+        entry     += p->nontemp_inst;
+        loop_inst += p->nontemp_inst;
+    }
+    void* R = (char*)V + (entry == loop_inst ? N * loop_slot : 0);
+    const PInst* inst = p->inst + entry;
 
-    for (int off = 0; off+N <= n; off += N) {
+    // Runs long enough to be loading from memory rather than cache prefetch ahead of their loads.
+    const int64_t distance = len >= p->prefetch_n ? p->prefetch_dist : 0;
+    if (distance) {
+        __atomic_fetch_add(&weft_prefetch_runs, 1, __ATOMIC_RELAXED);
+    }
+    for (; off+N <= n; off += N) {
+        if (distance && distance <= n - off - N) {
+            prefetch(p, off + distance, ptr);
+        }
         inst->fn(inst,off,0,V,R,ptr);
-        inst = p->inst + p->loop_inst;
-        R    = (char*)V + (N * p->loop_slot);
+        inst = p->inst + loop_inst;
+        R    = (char*)V + (N * loop_slot);
     }
-    for (unsigned tail = (unsigned)(n - n/N*N); tail; ) {
-        inst->fn(inst,n/N*N,tail,V,R,ptr);
+    for (unsigned tail = (unsigned)(n - off); tail; ) {
+        inst->fn(inst,off,tail,V,R,ptr);
         break;
     }
+    if (nontemporal) {
+        nontemporal_fence();
+    }
+}
+
+static void* alloc_scratch(const Program* p, const uint64_t state[]) {
+    char* V = malloc(N * (size_t)p->slots + sizeof *state * (size_t)p->states);
+    state ? memcpy(V + N*p->slots, state, sizeof *state * (size_t)p->states)
+          : memset(V + N*p->slots, 0    , sizeof *state * (size_t)p->states);
+    return V;
+}
+
+void weft_run(const weft_Program* p, int64_t n, void* const ptr[]) {
+    void* V = alloc_scratch(p, NULL);
+    run(p, 0, p->loop_inst, p->loop_slot, 0, n, n, V, ptr);
+    free(V);
+}
+
+#if defined(__wasm__)
+    static void parallel(void (*fn)(void*, int), void* ctx, int threads) {
+        for (int t = 0; t < threads; t++) {
+            fn(ctx, t);
+        }
+    }
+#else
+    typedef struct {
+        void (*fn)(void*, int);
+        void*  ctx;
+        int    t;
+        int    unused;
+    } Thread;
+
+    static void* thread_main(void* arg) {
+        const Thread* th = arg;
+        th->fn(th->ctx, th->t);
+        return NULL;
+    }
+
+    // Call fn(ctx,t) for each t in [0,threads), with t=0 on this thread.
+    static void parallel(void (*fn)(void*, int), void* ctx, int threads) {
+        Thread*    th  = calloc((size_t)threads, sizeof *th);
+        pthread_t* tid = calloc((size_t)threads, sizeof *tid);
+        bool*   joined = calloc((size_t)threads, sizeof *joined);
+        for (int t = 1; t < threads; t++) {
+            th[t] = (Thread){fn, ctx, t, 0};
+            joined[t] = pthread_create(tid+t, NULL, thread_main, th+t) == 0;
+            if (!joined[t]) {
+                fn(ctx, t);
+            }
+        }
+        fn(ctx, 0);
+        for (int t = 1; t < threads; t++) {
+            if (joined[t]) {
+                pthread_join(tid[t], NULL);
+            }
+        }
+        free(th);
+        free(tid);
+        free(joined);
+    }
+#endif
+
+// A thread's private counts for weft_histogram_add_32(), grown to fit the buckets it sees.
+// Only the first len, up to the highest bucket seen, are merged back into the real histogram.
+typedef struct {
+    uint32_t* count;
+    uint64_t  len, cap;
+} Histogram;
+
+// Thread t runs [t*share, (t+1)*share), in windows for weft_run_files().
+typedef struct {
+    const Program* p;
+    void* const*   ptr;
+    void**         thread_ptr;  // p->ptrs+1 per thread, each with counts of its own, or NULL.
+    int64_t        n, share, window;
+    uint64_t*      state;       // p->states per thread.
+    const bool*    ahead;       // Whether to read ahead of ptr[i], or NULL.
+    size_t         page;
+    int            totals;
+    int            unused;
+} ParallelRun;
+
+#if defined(__wasm__)
+    static void read_ahead(const ParallelRun* pr, int64_t off, int64_t end) {
+        (void)pr; (void)off; (void)end;
+    }
+#else
+    // Ask for the window starting at off while we work on the one before it.
+    static void read_ahead(const ParallelRun* pr, int64_t off, int64_t end) {
+        for (int i = 0; pr->ahead && i < pr->p->ptrs; i++) {
+            if (pr->ahead[i] && off < end) {
+                const size_t bytes = (size_t)pr->p->inst[pr->p->ptr_inst + i].imm,
+                             lo    = (size_t)off * bytes & ~(pr->page - 1),
+                             hi    = (size_t)(off + pr->window < end ? off + pr->window
+                                                                     : end) * bytes;
+                posix_madvise((char*)pr->ptr[i] + lo, hi - lo, POSIX_MADV_WILLNEED);
+            }
+        }
+    }
+#endif
+
+static void run_share(void* ctx, int t) {
+    const ParallelRun* pr = ctx;
+    const Program*     p  = pr->p;
+    const int64_t off = t * pr->share,
+                  n   = off + pr->share < pr->n ? off + pr->share : pr->n;
+    if (off < n) {
+        uint64_t*    state  = pr->state + t * p->states;
+        void* const* ptr    = pr->thread_ptr ? pr->thread_ptr + t * (p->ptrs+1) : pr->ptr;
+        const int64_t window = pr->window ? pr->window : n - off;
+        void* V = alloc_scratch(p, pr->totals ? NULL : state);
+        for (int64_t at = off; at < n; at += window) {
+            const int64_t next = at + window < n ? at + window : n;
+            read_ahead(pr, next, n);
+            // Windows after the first pick up where the invariant prefix left its values.
+            if (pr->totals) {
+                run(p, at == off ? p->scan_inst : p->scan_loop_inst,
+                    p->scan_loop_inst, p->scan_loop_slot, at, next, n - off, V, ptr);
+            } else {
+                run(p, at == off ? 0 : p->loop_inst, p->loop_inst, p->loop_slot,
+                    at, next, n - off, V, ptr);
+            }
+        }
+        if (pr->totals) {
+            memcpy(state, (char*)V + N*p->slots, sizeof *state * (size_t)p->states);
+        }
+        free(V);
+    }
+}
+
+static uint64_t combine_carry(int64_t imm, uint64_t x, uint64_t y);
+static bool is_scan(Stage*);
+static bool is_histogram(Stage*);
+static bool is_row(Stage*);
+static bool is_count_compress(Stage*);
+static void merge_histogram(void* const ptr[], int64_t imm, uint64_t state);
+
+// Run each thread's share with state of its own.  With more than one thread, programs with a
+// totals pass run it first, for each thread's scans to start from the totals of the threads
+// before it and its compressing stores from their counts.  Histograms are private to each thread
+// and merged into ptr[] once all threads finish.
+static void run_parallel(ParallelRun* pr, int threads) {
+    const Program* p     = pr->p;
+    void* const*   ptr   = pr->ptr;
+    const PInst*   state = p->inst + p->state_inst;
+    pr->state = calloc((size_t)(threads * p->states), sizeof *pr->state);
+
+    // Each thread's compressing stores advance counts of its own, in the first pass from 0 to
+    // count its share, then in the second from the combined counts of the threads before it.
+    bool*    counted = calloc((size_t)p->ptrs + 1, sizeof *counted);
+    int64_t* count   = NULL;
+    for (int i = p->scan_inst; p->scan_inst && i < p->state_inst; i++) {
+        if (is_count_compress(p->inst[i].fn)) {
+            counted[p->inst[i].imm >> 32] = true;
+            pr->thread_ptr = pr->thread_ptr ? pr->thread_ptr
+                                            : malloc((size_t)(threads * (p->ptrs+1)) * sizeof *ptr);
+        }
+    }
+    if (pr->thread_ptr) {
+        count = calloc((size_t)(threads * p->ptrs), sizeof *count);
+        for (int t = 0; t < threads; t++) {
+            for (int i = 0; i < p->ptrs; i++) {
+                pr->thread_ptr[t * (p->ptrs+1) + i] = counted[i] ? count + t * p->ptrs + i
+                                                                 : ptr[i];
+            }
+        }
+    }
+
+    if (p->scan_inst && threads > 1) {
+        pr->totals = true;
+        parallel(run_share, pr, threads);
+        pr->totals = false;
+    }
+    for (int i = 0; i < p->ptrs; i++) {
+        if (counted[i]) {
+            int64_t sum = *(const int64_t*)ptr[i];
+            for (int t = 0; t < threads; t++) {
+                const int64_t share = count[t * p->ptrs + i];
+                count[t * p->ptrs + i] = sum;
+                sum += share;
+            }
+        }
+    }
+    for (int k = 0; k < p->states; k++) {
+        // Each thread's scans start with the combined totals of the threads before it.
+        if (is_scan(state[k].fn)) {
+            uint64_t sum = 0;
+            for (int t = 0; t < threads; t++) {
+                const uint64_t total = pr->state[t * p->states + k];
+                pr->state[t * p->states + k] = sum;
+                sum = combine_carry(state[k].imm, sum, total);
+            }
+        }
+        // Each thread's histograms start empty and private, to be merged in when it's done.
+        if (is_histogram(state[k].fn)) {
+            for (int t = 0; t < threads; t++) {
+                Histogram* h = calloc(1, sizeof *h);
+                pr->state[t * p->states + k] = (uintptr_t)h;
+            }
+        }
+    }
+    parallel(run_share, pr, threads);
+
+    // The last thread's counts end where all the threads' stores do.
+    for (int i = 0; i < p->ptrs; i++) {
+        if (counted[i]) {
+            *(int64_t*)ptr[i] = count[(threads-1) * p->ptrs + i];
+        }
+    }
+    for (int k = 0; k < p->states; k++) {
+        if (is_histogram(state[k].fn)) {
+            for (int t = 0; t < threads; t++) {
+                merge_histogram(ptr, state[k].imm, pr->state[t * p->states + k]);
+            }
+        }
+    }
+    free(pr->state);
+    free(pr->thread_ptr);
+    free(count);
+    free(counted);
+}
+
+void weft_run_parallel(const weft_Program* p, int64_t n, void* const ptr[], int threads) {
+    // Each thread's share is whole chunks, leaving any tail to the last.
+    const int64_t chunks = (n + N-1) / N;
+    threads = threads < chunks ? threads : (int)chunks;
+    if (threads <= 1 || p->serial) {
+        weft_run(p, n, ptr);
+        return;
+    }
+    ParallelRun pr = {
+        .p     = p,
+        .ptr   = ptr,
+        .n     = n,
+        .share = (chunks + threads-1) / threads * N,
+    };
+    run_parallel(&pr, threads);
+}
+
+typedef struct {
+    const weft_Job** job;    // Sorted by program.
+    int*             first;  // Thread t runs job[first[t]] up to job[first[t+1]].
+    size_t           scratch;
+} BatchRun;
+
+static int job_cmp(const void* x, const void* y) {
+    const weft_Job *a = *(const weft_Job* const*)x,
+                   *b = *(const weft_Job* const*)y;
+    const uintptr_t ap = (uintptr_t)a->p, bp = (uintptr_t)b->p,
+                    aj = (uintptr_t)a   , bj = (uintptr_t)b;
+    return ap != bp ? (ap > bp) - (ap < bp)
+                    : (aj > bj) - (aj < bj);
+}
+
+// Would job y's invariant prefix compute just what job x's did, i.e. do they run the same program
+// with the same pointers to uniforms and everything else not varying by instance?
+static bool same_invariants(const weft_Job* x, const weft_Job* y) {
+    const Program* p = x->p;
+    if (p != y->p) {
+        return false;
+    }
+    for (int i = 0; i < p->ptrs; i++) {
+        if (p->inst[p->ptr_inst + i].imm == 0 && x->ptr[i] != y->ptr[i]) {
+            return false;
+        }
+    }
+    return true;
+}
 
+static void run_batch(void* ctx, int t) {
+    const BatchRun* br = ctx;
+    if (br->first[t] == br->first[t+1]) {
+        return;
+    }
+    char* V = malloc(br->scratch);
+    for (int j = br->first[t]; j < br->first[t+1]; j++) {
+        const Program* p = br->job[j]->p;
+        const int64_t  n = br->job[j]->n;
+        memset(V + N*p->slots, 0, sizeof(uint64_t) * (size_t)p->states);
+        // Jobs like the one before pick up where its invariant prefix left its values.
+        const bool same = j > br->first[t] && same_invariants(br->job[j-1], br->job[j]);
+        run(p, same ? p->loop_inst : 0, p->loop_inst, p->loop_slot, 0, n, n, V, br->job[j]->ptr);
+    }
+    free(V);
+}
+
+void weft_run_batch(const weft_Job* job, int count, int threads) {
+    threads = threads > 1 ? threads : 1;
+    BatchRun br = {
+        .job   = malloc((size_t)count * sizeof *br.job),
+        .first = calloc((size_t)threads + 1, sizeof *br.first),
+    };
+    // Each job costs about its chunks, plus one for the call; split that work evenly by thread.
+    int64_t work = 0;
+    int jobs = 0;
+    for (int j = 0; j < count; j++) {
+        if (job[j].n > 0) {
+            const Program* p = job[j].p;
+            const size_t scratch = N * (size_t)p->slots + sizeof(uint64_t) * (size_t)p->states;
+            br.scratch = br.scratch > scratch ? br.scratch : scratch;
+            br.job[jobs++] = job + j;
+            work += (job[j].n + N-1) / N + 1;
+        }
+    }
+    qsort(br.job, (size_t)jobs, sizeof *br.job, job_cmp);
+
+    threads = threads < jobs ? threads : jobs;
+    if (threads > 0) {
+        int64_t done = 0;
+        for (int j = 0, t = 1; j < jobs; j++) {
+            done += (br.job[j]->n + N-1) / N + 1;
+            while (t < threads && done * threads >= work * t) {
+                br.first[t++] = j+1;
+            }
+        }
+        br.first[threads] = jobs;
+        parallel(run_batch, &br, threads);
+    }
+    free(br.job);
+    free(br.first);
+}
+
+typedef struct {
+    const Program* p;
+    void* const*   ptr;
+    const int64_t* stride;
+    int64_t        width, height, rows;  // Thread t runs rows [t*rows, (t+1)*rows).
+} Run2D;
+
+static void run_rows(void* ctx, int t) {
+    const Run2D*   r2 = ctx;
+    const Program* p  = r2->p;
+    const int64_t y0 = t * r2->rows,
+                  y1 = y0 + r2->rows < r2->height ? y0 + r2->rows : r2->height;
+    if (y0 >= y1) {
+        return;
+    }
+    char*  V   = alloc_scratch(p, NULL);
+    void** ptr = calloc((size_t)p->ptrs + 1, sizeof *ptr);
+    for (int64_t y = y0; y < y1; y++) {
+        for (int i = 0; i < p->ptrs; i++) {
+            ptr[i] = r2->stride[i] ? (char*)r2->ptr[i] + y * r2->stride[i] : r2->ptr[i];
+        }
+        for (int k = 0; k < p->states; k++) {
+            if (is_row(p->inst[p->state_inst + k].fn)) {
+                memcpy(V + N*p->slots + (int)sizeof y * k, &y, sizeof y);
+            }
+        }
+        // Rows after the first pick up where the invariant prefix left its values.
+        run(p, y == y0 ? 0 : p->loop_inst, p->loop_inst, p->loop_slot,
+            0, r2->width, (y1 - y0) * r2->width, V, ptr);
+    }
+    free(ptr);
     free(V);
 }
 
+void weft_run_2d(const weft_Program* p, int64_t width, int64_t height,
+                 void* const ptr[], const int64_t row_stride_bytes[], int threads) {
+    // Scans, histograms and compressing stores carry from row to row, so only stateless
+    // programs split into tiles.  (Scans and compressing stores are what have a totals pass.)
+    threads = threads > 1 && !p->scan_inst ? threads : 1;
+    for (int k = 0; k < p->states; k++) {
+        threads = is_row(p->inst[p->state_inst + k].fn) ? threads : 1;
+    }
+    threads = threads < height ? threads : (int)height;
+    if (width > 0 && threads > 0) {
+        Run2D r2 = {
+            .p      = p,
+            .ptr    = ptr,
+            .stride = row_stride_bytes,
+            .width  = width,
+            .height = height,
+            .rows   = (height + threads-1) / threads,
+        };
+        parallel(run_rows, &r2, threads);
+    }
+}
+
+// A stream runs each push's whole chunks in place, and copies its last few instances' elements
+// into a chunk's worth of staging per varying pointer, to run once a later push or flush fills
+// it.  seg[] records where each staged run of instances came from, to copy stored values back.
+typedef struct weft_Stream {
+    const Program* p;
+    char*          V;        // Scratch for every run, so scans and histograms carry across them.
+    char*          staging;
+    void**         ptr;      // Staging for varying pointers, and the latest push's for the rest.
+    void**         seg_ptr;  // The ptr[] each seg came from, N copies of p->ptrs pointers.
+    int            pending, segs;
+    struct { int64_t off; int at, n; } seg[N];
+} Stream;
+
+weft_Stream* weft_stream_open(const weft_Program* p) {
+    size_t staging = 0;
+    for (int i = 0; i < p->ptrs; i++) {
+        const PInst info = p->inst[p->ptr_inst + i];
+        assert(info.z >= 0);
+        staging += N * (size_t)(info.imm < 0 ? -info.imm : info.imm) + (size_t)info.z;
+    }
+    Stream* s = calloc(1, sizeof *s);
+    s->p       = p;
+    s->V       = alloc_scratch(p, NULL);
+    s->staging = malloc(staging + 1);
+    s->ptr     = calloc((size_t)p->ptrs + 1, sizeof *s->ptr);
+    s->seg_ptr = calloc((size_t)(N * p->ptrs) + 1, sizeof *s->seg_ptr);
+    return s;
+}
+
+// Copy n instances' elements of a pointer described by info from src instance off to dst instance
+// at.  Strided elements are copied one by one, never touching the bytes between them.
+static void copy_instances(char* dst, int64_t at, const char* src, int64_t off, int n, PInst info) {
+    if (info.z == info.imm) {
+        memcpy(dst + at * info.imm, src + off * info.imm, (size_t)(n * info.imm));
+    } else {
+        for (int k = 0; k < n; k++) {
+            memcpy(dst + (at+k) * info.imm, src + (off+k) * info.imm, (size_t)info.z);
+        }
+    }
+}
+
+// Run the staged instances, then copy out what they stored to where they came from.
+static void drain(Stream* s) {
+    const Program* p    = s->p;
+    const PInst*   info = p->inst + p->ptr_inst;
+    run(p, 0, p->loop_inst, p->loop_slot, 0, s->pending, s->pending, s->V, s->ptr);
+    for (int j = 0; j < s->segs; j++) {
+        void* const* ptr = s->seg_ptr + j * p->ptrs;
+        for (int i = 0; i < p->ptrs; i++) {
+            if (info[i].x) {
+                copy_instances(ptr[i], s->seg[j].off, s->ptr[i], s->seg[j].at, s->seg[j].n,
+                               info[i]);
+            }
+        }
+    }
+    s->pending = s->segs = 0;
+}
+
+// Stage instances [off,off+n) of ptr[], with n <= N - s->pending.
+static void stage_instances(Stream* s, int64_t off, int n, void* const ptr[]) {
+    const Program* p    = s->p;
+    const PInst*   info = p->inst + p->ptr_inst;
+    char* staging = s->staging;
+    for (int i = 0; i < p->ptrs; i++) {
+        if (info[i].imm) {
+            // Negative strides walk down from the top of their staging.  Elements can be wider
+            // than their stride, so each pointer's staging has room for one more.
+            const int64_t bytes = info[i].imm < 0 ? -info[i].imm : info[i].imm;
+            s->ptr[i] = staging + (info[i].imm < 0 ? (N-1) * bytes : 0);
+            copy_instances(s->ptr[i], s->pending, ptr[i], off, n, info[i]);
+            staging += N * bytes + info[i].z;
+        } else {
+            s->ptr[i] = ptr[i];
+        }
+    }
+    memcpy(s->seg_ptr + s->segs * p->ptrs, ptr, sizeof *ptr * (size_t)p->ptrs);
+    s->seg[s->segs].off = off;
+    s->seg[s->segs].at  = s->pending;
+    s->seg[s->segs].n   = n;
+    s->segs++;
+    s->pending += n;
+}
+
+void weft_stream_push(weft_Stream* s, int64_t n, void* const ptr[]) {
+    const Program* p = s->p;
+    int64_t off = 0;
+    if (s->pending && n > 0) {
+        const int fill = n < N - s->pending ? (int)n : N - s->pending;
+        stage_instances(s, off, fill, ptr);
+        off += fill;
+        if (s->pending == N) {
+            drain(s);
+        }
+    }
+    const int64_t chunks = (n - off) / N * N;
+    if (chunks > 0) {
+        run(p, 0, p->loop_inst, p->loop_slot, off, off + chunks, n, s->V, ptr);
+        off += chunks;
+    }
+    if (off < n) {
+        stage_instances(s, off, (int)(n - off), ptr);
+    }
+}
+
+void weft_stream_flush(weft_Stream* s) {
+    if (s->pending) {
+        drain(s);
+    }
+    free(s->V);
+    free(s->staging);
+    free(s->ptr);
+    free(s->seg_ptr);
+    free(s);
+}
+
+#if defined(__wasm__)
+    int weft_run_files(const weft_Program* p, int64_t n, void* const ptr[],
+                       const char* const path[], int threads) {
+        (void)p; (void)n; (void)ptr; (void)path; (void)threads;
+        return 0;
+    }
+#else
+    int weft_run_files(const weft_Program* p, int64_t n, void* const ptr[],
+                       const char* const path[], int threads) {
+        void**  map   = calloc((size_t)p->ptrs + 1, sizeof *map);
+        size_t* len   = calloc((size_t)p->ptrs + 1, sizeof *len);
+        bool*   ahead = calloc((size_t)p->ptrs + 1, sizeof *ahead);
+        int     ok    = n >= 0;
+        int64_t widest = 1;
+
+        for (int i = 0; ok && i < p->ptrs; i++) {
+            const PInst info = p->inst[p->ptr_inst + i];
+            map[i] = ptr[i];
+            if (path[i]) {
+                // Inputs, including files updated in place, must already hold n elements;
+                // outputs are created or resized to fit.
+                const bool stored = info.x,
+                           output = info.x && !info.y;
+                const int  fd = open(path[i], output ? O_RDWR | O_CREAT
+                                            : stored ? O_RDWR : O_RDONLY, 0644);
+                struct stat st;
+                len[i] = (size_t)(n * info.imm);
+                ok = info.z > 0 && info.imm > 0 && fd >= 0
+                  && (output ? ftruncate(fd, (off_t)len[i]) == 0
+                             : fstat(fd, &st) == 0 && (size_t)st.st_size >= len[i]);
+                map[i] = MAP_FAILED;
+                if (ok && len[i]) {
+                    map[i] = mmap(NULL, len[i], stored ? PROT_READ | PROT_WRITE : PROT_READ,
+                                  MAP_SHARED, fd, 0);
+                    ok = map[i] != MAP_FAILED;
+                }
+                if (fd >= 0) {
+                    close(fd);
+                }
+                if (ok && len[i]) {
+                    posix_madvise(map[i], len[i], POSIX_MADV_SEQUENTIAL);
+                    ahead[i] = !stored;
+                }
+                widest = widest > info.imm ? widest : info.imm;
+            }
+        }
+
+        if (ok) {
+            // Windows of about 1MB of the widest file, then whole windows per thread.
+            ParallelRun pr = {
+                .p      = p,
+                .ptr    = map,
+                .n      = n,
+                .window = ((1<<20) / widest + N-1) / N * N,
+                .ahead  = ahead,
+                .page   = (size_t)sysconf(_SC_PAGESIZE),
+            };
+            const int64_t windows = (n + pr.window-1) / pr.window;
+            threads = threads > 1 && !p->serial ? threads : 1;
+            threads = threads < windows ? threads : (int)windows;
+            if (threads > 0) {
+                pr.share = (windows + threads-1) / threads * pr.window;
+                run_parallel(&pr, threads);
+            }
+        }
+
+        for (int i = 0; i < p->ptrs; i++) {
+            if (path[i] && len[i] && map[i] != MAP_FAILED) {
+                munmap(map[i], len[i]);
+            }
+        }
+        free(map);
+        free(len);
+        free(ahead);
+        return ok;
+    }
+#endif
+
+static Stage* best_stage(Stage*);
+static Stage* nontemporal_stage(Stage*);
+static double stage_cost(Stage*);
+static int varying_ptr(Stage*, int64_t imm, int* bytes, int* elem, bool* stored);
+static bool is_store_compress(Stage*);
+static Stage* count_compress(Stage*);
+stage(endif);
+
+static bool has_state(Stage* fn) {
+    return is_scan(fn) || is_histogram(fn) || is_row(fn);
+}
+
 Program* weft_compile(Builder* b) {
+    assert(b->region == 0);
     if (b->inst_len == 0 || !b->inst[b->inst_len-1].done) {
         inst_(b, (BInst){.kind=SIDE_EFFECT, .done=done});
     }
 
     struct {
         bool live, loop_dependent;
-        bool unusedA, unusedB;
-        int slot;
+        bool scan_live, scanned;  // scan_live: needed by a live scan or compressing store's
+                                  // count; scanned: depends on a scan.
+        int slot, inst, scan_slot;
     } *meta = calloc((size_t)b->inst_len, sizeof *meta);
 
-    int live_insts = 0;
+    int  live_insts = 0,
+         scan_insts = 0,
+         scans      = 0,
+         states     = 0;
+    bool nontemporal = false;
     for (int i = b->inst_len; i --> 0;) {
         const BInst inst = b->inst[i];
         if (inst.kind >= SIDE_EFFECT) {
             meta[i].live = true;
         }
         if (meta[i].live) {
-            live_insts++;
+            live_insts += inst.fn != endif;
+            nontemporal |= nontemporal_stage(i == b->inst_len-1 ? inst.done : inst.fn) != NULL;
             if (inst.x) { meta[inst.x-1].live = true; }
             if (inst.y) { meta[inst.y-1].live = true; }
             if (inst.z) { meta[inst.z-1].live = true; }
         }
+        if (meta[i].live && (is_scan(inst.fn) || is_store_compress(inst.fn))) {
+            meta[i].scan_live = true;
+            scans++;
+        }
+        if (meta[i].live && has_state(inst.fn)) {
+            states++;
+        }
+        if (meta[i].scan_live) {
+            // Counting what a compressing store would store only needs its mask.
+            scan_insts++;
+            if (inst.x) { meta[inst.x-1].scan_live = true; }
+            if (inst.y && !is_store_compress(inst.fn)) { meta[inst.y-1].scan_live = true; }
+            if (inst.z) { meta[inst.z-1].scan_live = true; }
+        }
     }
 
+    bool serial = false;
     for (int i = 0; i < b->inst_len; i++) {
         const BInst inst = b->inst[i];
         meta[i].loop_dependent = inst.kind >= LOAD
                               || (inst.x && meta[inst.x-1].loop_dependent)
                               || (inst.y && meta[inst.y-1].loop_dependent)
                               || (inst.z && meta[inst.z-1].loop_dependent);
+        const bool scanned_arg = (inst.x && meta[inst.x-1].scanned)
+                              || (inst.y && meta[inst.y-1].scanned)
+                              || (inst.z && meta[inst.z-1].scanned);
+        meta[i].scanned = scanned_arg || is_scan(inst.fn);
+        // The first pass counts compressing stores' lanes whether or not their region would run.
+        serial |= meta[i].live && ((scanned_arg && is_scan(inst.fn))
+                                || (inst.region && is_store_compress(inst.fn)));
     }
 
-    Program* p = malloc(sizeof(*p) + (size_t)live_insts * sizeof(*p->inst));
-    p->slots   = 0;
+    // Scans and compressing stores also get their own program ending with a done, then there's one
+    // PInst per state and one per pointer.  Programs that store get a copy of themselves with
+    // non-temporal stores.
+    const int total_insts = live_insts + (scans ? scan_insts + 1 : 0) + states + b->ptrs
+                          + (nontemporal ? live_insts : 0);
+    Program* p = calloc(1, sizeof(*p) + (size_t)total_insts * sizeof(*p->inst));
+    p->states  = states;
+    p->serial  = serial;
+    p->ptrs    = b->ptrs;
     int insts  = 0;
 
     for (int loop_dependent = 0; loop_dependent < 2; loop_dependent++) {
@@ -250,8 +961,16 @@ Program* weft_compile(Builder* b) {
         for (int i = 0; i < b->inst_len; i++) {
             if (meta[i].live && meta[i].loop_dependent == loop_dependent) {
                 const BInst inst = b->inst[i];
+                if (inst.fn == endif) {
+                    // Point the matching if_any past this region's insts and slots.
+                    const int if_inst = meta[inst.x-1].inst;
+                    p->inst[if_inst].imm = (int64_t)(insts - 1 - if_inst)
+                                         | (int64_t)(p->slots - meta[inst.x-1].slot) << 32;
+                    continue;
+                }
+                meta[i].inst = insts;
                 p->inst[insts++] = (PInst) {
-                    .fn  = (i == b->inst_len-1) ? inst.done : inst.fn,
+                    .fn  = (i == b->inst_len-1) ? inst.done : best_stage(inst.fn),
                     .x   = inst.x ? meta[inst.x-1].slot * N : 0,
                     .y   = inst.y ? meta[inst.y-1].slot * N : 0,
                     .z   = inst.z ? meta[inst.z-1].slot * N : 0,
@@ -264,6 +983,101 @@ Program* weft_compile(Builder* b) {
     }
     assert(insts == live_insts); (void)0;
 
+    for (int i = 0, k = 0; i < b->inst_len; i++) {
+        if (meta[i].live && has_state(b->inst[i].fn)) {
+            p->inst[meta[i].inst].imm |= N*p->slots + (int)sizeof(uint64_t) * k++;
+        }
+    }
+    if (scans) {
+        int slots = 0;
+        p->scan_inst = insts;
+        for (int loop_dependent = 0; loop_dependent < 2; loop_dependent++) {
+            if (loop_dependent) {
+                p->scan_loop_inst = insts;
+                p->scan_loop_slot = slots;
+            }
+            for (int i = 0; i < b->inst_len; i++) {
+                if (meta[i].scan_live && meta[i].loop_dependent == loop_dependent) {
+                    const BInst inst = b->inst[i];
+                    const bool  compress = is_store_compress(inst.fn);
+                    p->inst[insts++] = (PInst) {
+                        .fn  = compress ? count_compress(inst.fn) : best_stage(inst.fn),
+                        .x   = inst.x ? meta[inst.x-1].scan_slot * N : 0,
+                        .y   = inst.y && !compress ? meta[inst.y-1].scan_slot * N : 0,
+                        .z   = inst.z ? meta[inst.z-1].scan_slot * N : 0,
+                        .imm = p->inst[meta[i].inst].imm,
+                    };
+                    meta[i].scan_slot = slots;
+                    slots += inst.slots;
+                }
+            }
+        }
+        p->inst[insts++] = (PInst){.fn=done};
+    }
+
+    p->state_inst = insts;
+    for (int i = 0; i < b->inst_len; i++) {
+        if (meta[i].live && has_state(b->inst[i].fn)) {
+            p->inst[insts++] = (PInst){.fn=b->inst[i].fn, .imm=p->inst[meta[i].inst].imm};
+        }
+    }
+
+    // Pointers used with more than one stride get an element size of -1.  Otherwise the element
+    // size is the widest element read or written at the start of each instance's bytes.
+    p->ptr_inst = insts;
+    insts += b->ptrs;
+    for (int i = 0; i < b->inst_len; i++) {
+        int bytes, elem;
+        bool stored;
+        const int ptr = varying_ptr(b->inst[i].fn, b->inst[i].imm, &bytes, &elem, &stored);
+        if (meta[i].live && ptr >= 0 && bytes) {
+            PInst* info = p->inst + p->ptr_inst + ptr;
+            info->z    = info->z < 0 || (info->z && info->imm != bytes) ? -1
+                       : info->z > elem                               ? info->z
+                       :                                                elem;
+            info->imm  = bytes;
+            info->x   |= stored;
+            info->y   |= !stored;
+        }
+    }
+
+    // Runs loading more than 1MB, likely more than L2, prefetch by default far enough ahead to
+    // cover about 500 cycles of memory latency at the loop's estimated cost per instance.
+    int64_t loaded = 0;
+    for (int i = 0; i < p->ptrs; i++) {
+        const PInst info = p->inst[p->ptr_inst + i];
+        loaded += info.y && info.z > 0 && info.imm > 0 ? info.imm : 0;
+    }
+    double cost = 0;
+    for (int i = p->loop_inst; i < live_insts; i++) {
+        cost += stage_cost(p->inst[i].fn);
+    }
+    const int64_t distance = (int64_t)(500 * N / (cost > 1 ? cost : 1));
+    p->prefetch_dist = b->prefetch_dist ? b->prefetch_dist
+                     : distance < N     ? N
+                     : distance > 1024  ? 1024
+                     :                    distance;
+    p->prefetch_n = loaded && p->prefetch_dist > 0 ? (1<<20) / loaded + 1 : INT64_MAX;
+
+    if (nontemporal) {
+        p->nontemp_inst = insts;
+        for (int i = 0; i < live_insts; i++) {
+            PInst inst = p->inst[i];
+            inst.fn = nontemporal_stage(inst.fn) ? nontemporal_stage(inst.fn) : inst.fn;
+            p->inst[insts++] = inst;
+        }
+        // By default, runs that would store more than 32MB, likely more than the last level cache.
+        int64_t stored = 0;
+        for (int i = 0; i < p->ptrs; i++) {
+            const PInst info = p->inst[p->ptr_inst + i];
+            stored += info.x && info.z > 0 && info.imm > 0 ? info.imm : 0;
+        }
+        p->nontemp_n = b->nontemp_n ? b->nontemp_n
+                     : stored       ? ((int64_t)32<<20) / stored + 1
+                     :                INT64_MAX;
+    }
+    assert(insts == total_insts); (void)0;
+
     free(meta);
     free(b->inst);
     free(b->cse);
@@ -303,7 +1117,7 @@ Program* weft_compile(Builder* b) {
         } inst = {mask(Rd,5), mask(imm,16), mask(hw,2), 0xe5, 1};
         return emit(buf, inst);
     }
-    static char* dup(char* buf, int Rd, int Rn, int imm, int Q) {
+    static char* dup_general(char* buf, int Rd, int Rn, int imm, int Q) {
         struct {
             uint32_t Rd  : 5;
             uint32_t Rn  : 5;
@@ -325,6 +1139,58 @@ Program* weft_compile(Builder* b) {
         } inst = {mask(Rd,5), mask(Rn,5), 0, mask(Rm,5), 0x458};
         return emit(buf, inst);
     }
+    static char* simd3(char* buf, int U, int size, int opcode, int Rd, int Rn, int Rm, int Q) {
+        struct {
+            uint32_t Rd     : 5;
+            uint32_t Rn     : 5;
+            uint32_t bit10  : 1;
+            uint32_t opcode : 5;
+            uint32_t Rm     : 5;
+            uint32_t bit21  : 1;
+            uint32_t size   : 2;
+            uint32_t mid    : 5;
+            uint32_t U      : 1;
+            uint32_t Q      : 1;
+            uint32_t z      : 1;
+        } inst = {mask(Rd,5), mask(Rn,5), 1, mask(opcode,5), mask(Rm,5), 1,
+                  mask(size,2), 0xe, mask(U,1), mask(Q,1), 0};
+        return emit(buf, inst);
+    }
+    static char* simd2(char* buf, int U, int size, int opcode, int Rd, int Rn, int Q) {
+        struct {
+            uint32_t Rd     : 5;
+            uint32_t Rn     : 5;
+            uint32_t two    : 2;
+            uint32_t opcode : 5;
+            uint32_t mid    : 5;
+            uint32_t size   : 2;
+            uint32_t top    : 5;
+            uint32_t U      : 1;
+            uint32_t Q      : 1;
+            uint32_t z      : 1;
+        } inst = {mask(Rd,5), mask(Rn,5), 2, mask(opcode,5), 0x10,
+                  mask(size,2), 0xe, mask(U,1), mask(Q,1), 0};
+        return emit(buf, inst);
+    }
+
+    // Apply a 3-same or 2-reg-misc instruction to each register fragment of a bits-wide value.
+    #define frags(bits) ((bits) <= 16 ? 1 : (bits)/16)
+    #define JIT_SIMD3(name,bits,U,size,opcode)                                                    \
+        static char* jit_##name(char* buf, int d[], int x[], int y[], int z[], int64_t imm) {     \
+            (void)z; (void)imm;                                                                   \
+            for (int i = 0; i < frags(bits); i++) {                                               \
+                buf = simd3(buf, U,size,opcode, d[i],x[i],y[i], bits > 8);                        \
+            }                                                                                     \
+            return buf;                                                                           \
+        }
+    #define JIT_SIMD2(name,bits,U,size,opcode)                                                    \
+        static char* jit_##name(char* buf, int d[], int x[], int y[], int z[], int64_t imm) {     \
+            (void)y; (void)z; (void)imm;                                                          \
+            for (int i = 0; i < frags(bits); i++) {                                               \
+                buf = simd2(buf, U,size,opcode, d[i],x[i], bits > 8);                             \
+            }                                                                                     \
+            return buf;                                                                           \
+        }
 #endif
 
 
@@ -336,20 +1202,20 @@ stage(splat_64) { int64_t *r=R; each r[i] = (int64_t)inst->imm; next(r+N); }
 #if defined(__aarch64__)
     static char* jit_splat_8(char* buf, int d[], int x[], int y[], int z[], int64_t imm) {
         (void)x; (void)y; (void)z;
-        buf = movz(buf, Rtmp, imm, 0);     // mov tmp, imm
-        return dup(buf, d[0], Rtmp, 1,0);  // dup.8b d[0], tmp
+        buf = movz(buf, Rtmp, imm, 0);             // mov tmp, imm
+        return dup_general(buf, d[0], Rtmp, 1,0);  // dup.8b d[0], tmp
     }
     static char* jit_splat_16(char* buf, int d[], int x[], int y[], int z[], int64_t imm) {
         (void)x; (void)y; (void)z;
-        buf = movz(buf, Rtmp, imm, 0);     // mov tmp, imm
-        return dup(buf, d[0], Rtmp, 2,1);  // dup.8h d[0],tmp
+        buf = movz(buf, Rtmp, imm, 0);             // mov tmp, imm
+        return dup_general(buf, d[0], Rtmp, 2,1);  // dup.8h d[0],tmp
     }
     static char* jit_splat_32(char* buf, int d[], int x[], int y[], int z[], int64_t imm) {
         (void)x; (void)y; (void)z;
-        buf = movz(buf, Rtmp, imm>> 0, 0);  // mov  tmp, imm15:0
-        buf = movk(buf, Rtmp, imm>>16, 1);  // movk tmp, imm31:16
-        buf =  dup(buf, d[0], Rtmp, 4, 1);  // dup.4s d[0], tmp
-        return dup(buf, d[1], Rtmp, 4, 1);  // dup.4s d[1], tmp
+        buf = movz(buf, Rtmp, imm>> 0, 0);          // mov  tmp, imm15:0
+        buf = movk(buf, Rtmp, imm>>16, 1);          // movk tmp, imm31:16
+        buf =  dup_general(buf, d[0], Rtmp, 4, 1);  // dup.4s d[0], tmp
+        return dup_general(buf, d[1], Rtmp, 4, 1);  // dup.4s d[1], tmp
     }
     static char* jit_splat_64(char* buf, int d[], int x[], int y[], int z[], int64_t imm) {
         (void)x; (void)y; (void)z;
@@ -357,10 +1223,10 @@ stage(splat_64) { int64_t *r=R; each r[i] = (int64_t)inst->imm; next(r+N); }
         buf = movk(buf, Rtmp, imm>>16, 1);
         buf = movk(buf, Rtmp, imm>>32, 2);
         buf = movk(buf, Rtmp, imm>>48, 3);
-        buf =  dup(buf, d[0], Rtmp, 8, 1);
-        buf =  dup(buf, d[1], Rtmp, 8, 1);
-        buf =  dup(buf, d[2], Rtmp, 8, 1);
-        return dup(buf, d[3], Rtmp, 8, 1);
+        buf =  dup_general(buf, d[0], Rtmp, 8, 1);
+        buf =  dup_general(buf, d[1], Rtmp, 8, 1);
+        buf =  dup_general(buf, d[2], Rtmp, 8, 1);
+        return dup_general(buf, d[3], Rtmp, 8, 1);
     }
 #else
     #define jit_splat_8  NULL
@@ -387,10 +1253,18 @@ stage(uniform_16) { int16_t *r=R, u=*(const int16_t*)ptr[inst->imm]; each r[i] =
 stage(uniform_32) { int32_t *r=R, u=*(const int32_t*)ptr[inst->imm]; each r[i] = u; next(r+N); }
 stage(uniform_64) { int64_t *r=R, u=*(const int64_t*)ptr[inst->imm]; each r[i] = u; next(r+N); }
 
-V8  weft_uniform_8 (Builder* b, int ptr) { return inst(b, UNIFORM,8 ,uniform_8 , .imm=ptr); }
-V16 weft_uniform_16(Builder* b, int ptr) { return inst(b, UNIFORM,16,uniform_16, .imm=ptr); }
-V32 weft_uniform_32(Builder* b, int ptr) { return inst(b, UNIFORM,32,uniform_32, .imm=ptr); }
-V64 weft_uniform_64(Builder* b, int ptr) { return inst(b, UNIFORM,64,uniform_64, .imm=ptr); }
+V8  weft_uniform_8 (Builder* b, int ptr) {
+    return inst(b, UNIFORM,8 ,uniform_8 , .imm=use_ptr(b,ptr));
+}
+V16 weft_uniform_16(Builder* b, int ptr) {
+    return inst(b, UNIFORM,16,uniform_16, .imm=use_ptr(b,ptr));
+}
+V32 weft_uniform_32(Builder* b, int ptr) {
+    return inst(b, UNIFORM,32,uniform_32, .imm=use_ptr(b,ptr));
+}
+V64 weft_uniform_64(Builder* b, int ptr) {
+    return inst(b, UNIFORM,64,uniform_64, .imm=use_ptr(b,ptr));
+}
 
 stage(load_8) {
     int8_t* r = R;
@@ -417,10 +1291,88 @@ stage(load_64) {
     next(r+N);
 }
 
-V8  weft_load_8 (Builder* b, int ptr) { return inst(b, LOAD,8 ,load_8 , .imm=ptr); }
-V16 weft_load_16(Builder* b, int ptr) { return inst(b, LOAD,16,load_16, .imm=ptr); }
-V32 weft_load_32(Builder* b, int ptr) { return inst(b, LOAD,32,load_32, .imm=ptr); }
-V64 weft_load_64(Builder* b, int ptr) { return inst(b, LOAD,64,load_64, .imm=ptr); }
+V8  weft_load_8 (Builder* b, int ptr) {
+    return inst(b, LOAD,8 ,load_8 , .imm=use_ptr(b,ptr));
+}
+V16 weft_load_16(Builder* b, int ptr) {
+    return inst(b, LOAD,16,load_16, .imm=use_ptr(b,ptr));
+}
+V32 weft_load_32(Builder* b, int ptr) {
+    return inst(b, LOAD,32,load_32, .imm=use_ptr(b,ptr));
+}
+V64 weft_load_64(Builder* b, int ptr) {
+    return inst(b, LOAD,64,load_64, .imm=use_ptr(b,ptr));
+}
+
+// Strided loads read lane i from byte (off+i)*stride of ptr, with imm = stride << 32 | ptr.
+static void load_strided_(const PInst* inst, int64_t off, unsigned tail, void* R,
+                          void* const ptr[], size_t bytes) {
+    const int64_t stride = inst->imm >> 32;
+    const char*   src    = (const char*)ptr[(uint32_t)inst->imm] + off * stride;
+    for (int i = 0; i < (tail ? (int)tail : N); i++) {
+        memcpy((char*)R + (size_t)i * bytes, src + i * stride, bytes);
+    }
+}
+#define LOAD_STRIDED(B,U)                                                                       \
+    stage(load_strided_##B) { load_strided_(inst,off,tail,R,ptr, B/8); next((U*)R+N); }         \
+    V##B weft_load_strided_##B(Builder* b, int ptr, int stride_bytes) {                         \
+        if (stride_bytes == B/8) { return weft_load_##B(b,ptr); }                               \
+        return inst(b, LOAD,B,load_strided_##B, .imm=(int64_t)((uint64_t)stride_bytes << 32    \
+                                                              | (uint32_t)use_ptr(b,ptr)));     \
+    }
+LOAD_STRIDED( 8, uint8_t)
+LOAD_STRIDED(16,uint16_t)
+LOAD_STRIDED(32,uint32_t)
+LOAD_STRIDED(64,uint64_t)
+
+void weft_prefetch_distance(Builder* b, int64_t n) {
+    b->prefetch_dist = n;
+}
+
+stage(index_32) { int32_t *r=R; each r[i] = (int32_t)(off+i); next(r+N); }
+stage(index_64) { int64_t *r=R; each r[i] =          off+i ; next(r+N); }
+
+#if defined(__aarch64__)
+    static char* jit_index_32(char* buf, int d[], int x[], int y[], int z[], int64_t imm) {
+        (void)x; (void)y; (void)z; (void)imm;
+        buf =  dup_general(buf, d[0], Ri, 4, 1);  // dup.4s d[0], i
+        return dup_general(buf, d[1], Ri, 4, 1);  // dup.4s d[1], i
+    }
+    static char* jit_index_64(char* buf, int d[], int x[], int y[], int z[], int64_t imm) {
+        (void)x; (void)y; (void)z; (void)imm;
+        for (int i = 0; i < 4; i++) {
+            buf = dup_general(buf, d[i], Ri, 8, 1);  // dup.2d d[i], i
+        }
+        return buf;
+    }
+#else
+    #define jit_index_32 NULL
+    #define jit_index_64 NULL
+#endif
+
+// These are LOAD so they're recomputed each loop iteration rather than hoisted.
+V32 weft_index_32(Builder* b) { return inst(b, LOAD,32,index_32, .jit=jit_index_32); }
+V64 weft_index_64(Builder* b) { return inst(b, LOAD,64,index_64, .jit=jit_index_64); }
+
+// weft_run_2d() writes the row into a 64-bit state word at byte offset (uint32_t)imm from V;
+// it stays 0 under weft_run() and friends.
+stage(row_32) {
+    int32_t *r=R, y=(int32_t)*(const int64_t*)((char*)V + (uint32_t)inst->imm);
+    each r[i] = y;
+    next(r+N);
+}
+stage(row_64) {
+    int64_t *r=R, y=*(const int64_t*)((char*)V + (uint32_t)inst->imm);
+    each r[i] = y;
+    next(r+N);
+}
+
+V32 weft_row_32(Builder* b) { return inst(b, LOAD,32,row_32); }
+V64 weft_row_64(Builder* b) { return inst(b, LOAD,64,row_64); }
+
+static bool is_row(Stage* fn) {
+    return fn == row_32 || fn == row_64;
+}
 
 stage(store_8) {
     tail ? memcpy((int8_t*)ptr[inst->imm] + off, v(x), 1*tail)
@@ -481,16 +1433,21 @@ typedef struct { int id; } V0;
 #endif
 
 void weft_store_8 (Builder* b, int ptr, V8  x) {
-    (void)inst(b,SIDE_EFFECT,0,store_8 , .done=store_8_done , .x=x.id, .imm=ptr, .jit=jit_store_8);
+    (void)inst(b,SIDE_EFFECT,0,store_8 , .done=store_8_done , .x=x.id, .imm=use_ptr(b,ptr)
+                                                , .jit=jit_store_8);
 }
 void weft_store_16(Builder* b, int ptr, V16 x) {
-    (void)inst(b,SIDE_EFFECT,0,store_16, .done=store_16_done, .x=x.id, .imm=ptr);
+    (void)inst(b,SIDE_EFFECT,0,store_16, .done=store_16_done, .x=x.id, .imm=use_ptr(b,ptr));
 }
 void weft_store_32(Builder* b, int ptr, V32 x) {
-    (void)inst(b,SIDE_EFFECT,0,store_32, .done=store_32_done, .x=x.id, .imm=ptr);
+    (void)inst(b,SIDE_EFFECT,0,store_32, .done=store_32_done, .x=x.id, .imm=use_ptr(b,ptr));
 }
 void weft_store_64(Builder* b, int ptr, V64 x) {
-    (void)inst(b,SIDE_EFFECT,0,store_64, .done=store_64_done, .x=x.id, .imm=ptr);
+    (void)inst(b,SIDE_EFFECT,0,store_64, .done=store_64_done, .x=x.id, .imm=use_ptr(b,ptr));
+}
+
+void weft_nontemporal_stores(Builder* b, int64_t n) {
+    b->nontemp_n = n;
 }
 
 stage(assert_8)  { int8_t  *x=v(x); (void)x; each assert(x[i]); next(R); }
@@ -503,6 +1460,80 @@ void weft_assert_16(Builder* b, V16 x){inst_(b,(BInst){.fn=assert_16, .kind=SIDE
 void weft_assert_32(Builder* b, V32 x){inst_(b,(BInst){.fn=assert_32, .kind=SIDE_EFFECT, .x=x.id});}
 void weft_assert_64(Builder* b, V64 x){inst_(b,(BInst){.fn=assert_64, .kind=SIDE_EFFECT, .x=x.id});}
 
+// if_any's imm packs how many insts and slots its region spans, to skip them when no lane is set.
+#define IF_ANY(B,U)                                                                             \
+    stage(if_any_##B) {                                                                         \
+        U *x=v(x), any = 0;                                                                     \
+        each any |= x[i];                                                                       \
+        if (!any) {                                                                             \
+            R     = (char*)R + N * (inst->imm >> 32);                                           \
+            inst += (uint32_t)inst->imm;                                                        \
+        }                                                                                       \
+        next(R);                                                                                \
+    }
+IF_ANY( 8, uint8_t)
+IF_ANY(16,uint16_t)
+IF_ANY(32,uint32_t)
+IF_ANY(64,uint64_t)
+
+// endif is never run; weft_compile() folds it into its if_any.
+stage(endif) { next(R); }
+
+#if defined(__aarch64__)
+    // umov tmp, x[0].{b,h,s,d}[0], then cbz tmp past the region, patched by jit_patch_cbz().
+    static char* jit_if_any(char* buf, int x, int size) {
+        buf = emit4(buf, 0x0e003c00 | (uint32_t)(size == 8) << 30
+                                    | (uint32_t)size << 16 | (uint32_t)x << 5 | (uint32_t)Rtmp);
+        return emit4(buf, 0xb4000000 | (uint32_t)Rtmp);
+    }
+    static void jit_patch_cbz(char* cbz, char* target) {
+        uint32_t inst;
+        memcpy(&inst, cbz, sizeof inst);
+        inst |= (mask((target - cbz)/4, 19)) << 5;
+        memcpy(cbz, &inst, sizeof inst);
+    }
+    #define JIT_IF_ANY(B)                                                                       \
+        static char* jit_if_any_##B(char* buf, int d[], int x[], int y[], int z[], int64_t imm) { \
+            (void)d; (void)y; (void)z; (void)imm;                                               \
+            return jit_if_any(buf, x[0], B/8);                                                  \
+        }
+    JIT_IF_ANY(8) JIT_IF_ANY(16) JIT_IF_ANY(32) JIT_IF_ANY(64)
+    static char* jit_endif(char* buf, int d[], int x[], int y[], int z[], int64_t imm) {
+        (void)d; (void)x; (void)y; (void)z; (void)imm;
+        return buf;
+    }
+#else
+    static void jit_patch_cbz(char* cbz, char* target) { (void)cbz; (void)target; }
+    #define jit_if_any_8  NULL
+    #define jit_if_any_16 NULL
+    #define jit_if_any_32 NULL
+    #define jit_if_any_64 NULL
+    #define jit_endif     NULL
+#endif
+
+static bool is_if_any(Stage* fn) {
+    return fn == if_any_8 || fn == if_any_16 || fn == if_any_32 || fn == if_any_64;
+}
+
+void weft_if_any_8 (Builder* b, V8  mask) {
+    b->region = inst(b, SIDE_EFFECT,0, if_any_8 , .x=mask.id, .jit=jit_if_any_8 ).id;
+}
+void weft_if_any_16(Builder* b, V16 mask) {
+    b->region = inst(b, SIDE_EFFECT,0, if_any_16, .x=mask.id, .jit=jit_if_any_16).id;
+}
+void weft_if_any_32(Builder* b, V32 mask) {
+    b->region = inst(b, SIDE_EFFECT,0, if_any_32, .x=mask.id, .jit=jit_if_any_32).id;
+}
+void weft_if_any_64(Builder* b, V64 mask) {
+    b->region = inst(b, SIDE_EFFECT,0, if_any_64, .x=mask.id, .jit=jit_if_any_64).id;
+}
+void weft_endif(Builder* b) {
+    const int id = b->region;
+    assert(id);
+    b->region = b->inst[id-1].region;
+    (void)inst(b, SIDE_EFFECT,0, endif, .x=id, .jit=jit_endif);
+}
+
 static bool is_splat(Builder* b, int id, int64_t imm) {
     return b->inst[id-1].kind == SPLAT
         && b->inst[id-1].imm  == imm;
@@ -519,11 +1550,641 @@ static void sort_commutative(int* x, int* y) {
     *y = hi;
 }
 
+// compress_lanes[k] lists the lanes set in k, one per byte from the lowest, for shuffling just
+// those lanes to the front of a chunk.  Its bytes past them are 0.
+#define COMPRESS_POP(k)    (((k)>>0&1) + ((k)>>1&1) + ((k)>>2&1) + ((k)>>3&1) \
+                          + ((k)>>4&1) + ((k)>>5&1) + ((k)>>6&1) + ((k)>>7&1))
+#define COMPRESS_LANE(k,i) ((uint64_t)((k)>>(i)&1) * (i) << 8*COMPRESS_POP((k) & ((1<<(i))-1)))
+#define COMPRESS_LANES(k)  (COMPRESS_LANE(k,0) | COMPRESS_LANE(k,1) | COMPRESS_LANE(k,2) \
+                          | COMPRESS_LANE(k,3) | COMPRESS_LANE(k,4) | COMPRESS_LANE(k,5) \
+                          | COMPRESS_LANE(k,6) | COMPRESS_LANE(k,7))
+#define COMPRESS_4(k)  COMPRESS_LANES(k), COMPRESS_LANES(k+1), \
+                       COMPRESS_LANES(k+2), COMPRESS_LANES(k+3)
+#define COMPRESS_16(k) COMPRESS_4(k), COMPRESS_4(k+4), COMPRESS_4(k+8), COMPRESS_4(k+12)
+#define COMPRESS_64(k) COMPRESS_16(k), COMPRESS_16(k+16), COMPRESS_16(k+32), COMPRESS_16(k+48)
+static const uint64_t compress_lanes[256] = {
+    COMPRESS_64(0), COMPRESS_64(64), COMPRESS_64(128), COMPRESS_64(192),
+};
+#undef COMPRESS_POP
+#undef COMPRESS_LANE
+#undef COMPRESS_LANES
+#undef COMPRESS_4
+#undef COMPRESS_16
+#undef COMPRESS_64
+
+#if defined(__ARM_NEON)
+    // tbl indices moving the lanes set in k to the front of 16 bytes of bytes-wide lanes.
+    static uint8x16_t compress_shuffle(unsigned k, int bytes) {
+        static const uint8_t iota[16] = {0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15};
+        uint8x16_t idx = vcombine_u8(vcreate_u8(compress_lanes[k]), vdup_n_u8(0));
+        for (int b = 1; b < bytes; b *= 2) {
+            idx = vzip1q_u8(idx, idx);
+            idx = vaddq_u8(idx, idx);
+        }
+        return vorrq_u8(idx, vandq_u8(vld1q_u8(iota), vdupq_n_u8((uint8_t)(bytes-1))));
+    }
+#endif
+
+// Pack the bytes-wide lanes of x set in k to the front of r, which has room for a chunk and 16
+// bytes more.  Returns how many bytes that is.
+static int compress(char* r, const char* x, unsigned k, int bytes) {
+#if defined(__ARM_NEON)
+    if (bytes == 1) {
+        vst1_u8((uint8_t*)r, vqtbl1_u8(vcombine_u8(vld1_u8((const uint8_t*)x), vdup_n_u8(0)),
+                                       vget_low_u8(compress_shuffle(k, 1))));
+        return __builtin_popcount(k);
+    }
+    const int lanes = 16 / bytes;
+    int n = 0;
+    for (int i = 0; i < N; i += lanes) {
+        const unsigned part = k >> i & ((1u << lanes) - 1);
+        vst1q_u8((uint8_t*)r + n, vqtbl1q_u8(vld1q_u8((const uint8_t*)x + i*bytes),
+                                             compress_shuffle(part, bytes)));
+        n += __builtin_popcount(part) * bytes;
+    }
+    return n;
+#else
+    const uint64_t lanes = compress_lanes[k];
+    for (int i = 0; i < N; i++) {
+        memcpy(r + i*bytes, x + (int)(lanes >> 8*i & 7) * bytes, (size_t)bytes);
+    }
+    return __builtin_popcount(k) * bytes;
+#endif
+}
+
+// Copy out the len bytes compress() packed, and advance the count past them.
+static void store_compressed(const PInst* inst, void* const ptr[], const char* packed, int len,
+                             int bytes) {
+    int64_t* count = ptr[inst->imm >> 32];
+    memcpy((char*)ptr[(uint32_t)inst->imm] + *count * bytes, packed, (size_t)len);
+    *count += len / bytes;
+}
+
+// Gather each lane's mask into one bit of k, then shuffle the lanes it picks out into tmp by
+// compress_lanes[k] and copy them out in one go; no out-of-bounds writes.  weft_run_parallel()'s
+// first pass just counts them.
+#define STORE_COMPRESS(B,U)                                                                     \
+    static unsigned compress_mask_##B(const U mask[N], unsigned tail) {                         \
+        unsigned k = 0;                                                                         \
+        each k |= (unsigned)(mask[i] != 0) << i;                                                \
+        return k & (tail ? (1u << tail) - 1 : 0xff);                                            \
+    }                                                                                           \
+    static void store_compress_##B##_(const PInst* inst, unsigned tail, void* V,                \
+                                      void* const ptr[]) {                                      \
+        char tmp[N*B/8 + 16];                                                                   \
+        store_compressed(inst, ptr, tmp,                                                        \
+                         compress(tmp, v(y), compress_mask_##B(v(x), tail), B/8), B/8);         \
+    }                                                                                           \
+    stage(store_compress_##B) { (void)off; store_compress_##B##_(inst,tail,V,ptr); next(R); }   \
+    stage(store_compress_##B##_done) {                                                          \
+        (void)off; (void)R;                                                                     \
+        store_compress_##B##_(inst,tail,V,ptr);                                                 \
+    }                                                                                           \
+    stage(count_compress_##B) {                                                                 \
+        int64_t* count = ptr[inst->imm >> 32];                                                  \
+        *count += __builtin_popcount(compress_mask_##B(v(x), tail));                            \
+        (void)off;                                                                              \
+        next(R);                                                                                \
+    }                                                                                           \
+    void weft_store_compress_##B(Builder* b, int ptr, int count_ptr, V##B mask, V##B x) {       \
+        if (is_splat(b,mask.id,0)) { return; }                                                  \
+        (void)inst(b,SIDE_EFFECT,0,store_compress_##B, .done=store_compress_##B##_done          \
+                                                     , .x=mask.id, .y=x.id                      \
+                                                     , .imm=(int64_t)use_ptr(b,count_ptr) << 32 \
+                                                           | use_ptr(b,ptr));                   \
+    }
+STORE_COMPRESS( 8, uint8_t)
+STORE_COMPRESS(16,uint16_t)
+STORE_COMPRESS(32,uint32_t)
+STORE_COMPRESS(64,uint64_t)
+
+static bool is_store_compress(Stage* fn) {
+    return fn == store_compress_8  || fn == store_compress_16
+        || fn == store_compress_32 || fn == store_compress_64;
+}
+
+// The stage counting what a store_compress stage would store, for weft_run_parallel()'s first pass.
+static Stage* count_compress(Stage* fn) {
+    return fn == store_compress_8  ? count_compress_8
+         : fn == store_compress_16 ? count_compress_16
+         : fn == store_compress_32 ? count_compress_32
+         :                           count_compress_64;
+}
+static bool is_count_compress(Stage* fn) {
+    return fn == count_compress_8  || fn == count_compress_16
+        || fn == count_compress_32 || fn == count_compress_64;
+}
+
+#define STORE_MASKED(B,U)                                                                       \
+    static void store_masked_##B##_(const PInst* inst, int64_t off, unsigned tail, void* V,     \
+                                    void* const ptr[]) {                                        \
+        const U *mask=v(x), *x=v(y);                                                            \
+        U* dst = (U*)ptr[inst->imm] + off;                                                      \
+        for (int i = 0; i < (tail ? (int)tail : N); i++) {                                      \
+            if (mask[i]) { dst[i] = x[i]; }                                                     \
+        }                                                                                       \
+    }                                                                                           \
+    stage(store_masked_##B) { store_masked_##B##_(inst,off,tail,V,ptr); next(R); }              \
+    stage(store_masked_##B##_done) { (void)R; store_masked_##B##_(inst,off,tail,V,ptr); }       \
+    void weft_store_masked_##B(Builder* b, int ptr, V##B mask, V##B x) {                        \
+        int64_t imm;                                                                            \
+        if (any_splat(b,mask.id,&imm)) {                                                        \
+            if (imm) { weft_store_##B(b,ptr,x); }                                               \
+            return;                                                                             \
+        }                                                                                       \
+        (void)inst(b,SIDE_EFFECT,0,store_masked_##B, .done=store_masked_##B##_done              \
+                                                   , .x=mask.id, .y=x.id, .imm=use_ptr(b,ptr)   \
+                                                   , .jit=jit_store_masked_##B);                \
+    }
+
+#if defined(__aarch64__)
+    // The JIT handles one lane at a time, so this is just a store we branch over.
+    static char* jit_store_masked_8(char* buf, int d[], int x[], int y[], int z[], int64_t imm) {
+        char* const cbz = jit_if_any(buf, x[0], 1) - 4;
+        buf = jit_store_8(cbz+4, d,y,y,z, imm);
+        jit_patch_cbz(cbz, buf);
+        return buf;
+    }
+#else
+    #define jit_store_masked_8 NULL
+#endif
+#define jit_store_masked_16 NULL
+#define jit_store_masked_32 NULL
+#define jit_store_masked_64 NULL
+STORE_MASKED( 8, uint8_t)
+STORE_MASKED(16,uint16_t)
+STORE_MASKED(32,uint32_t)
+STORE_MASKED(64,uint64_t)
+
+// Which ptr this inst loads or stores one element of per instance, and that element's size.
+static int varying_ptr(Stage* fn, int64_t imm, int* bytes, int* elem, bool* stored) {
+    Stage* const fns[][4] = {
+        {        load_8,         load_16,         load_32,         load_64},
+        {load_strided_8, load_strided_16, load_strided_32, load_strided_64},
+        {       store_8,        store_16,        store_32,        store_64},
+        {store_masked_8, store_masked_16, store_masked_32, store_masked_64},
+    };
+    for (int f = 0; f < 4; f++) {
+        for (int k = 0; k < 4; k++) {
+            if (fn == fns[f][k]) {
+                *elem   = 1 << k;
+                *bytes  = f == 1 ? (int)(imm >> 32) : *elem;
+                *stored = f >= 2;
+                return (int)(uint32_t)imm;
+            }
+        }
+    }
+    return -1;
+}
+
+// Each scan keeps its running total in a 64-bit carry past the value slots, at byte offset
+// (uint32_t)imm from V.  weft_run() zeroes carries, so max_s scans keep theirs with the sign bit
+// flipped to make 0 mean the minimum.  imm's high bits hold the scan's bit width, plus 256 for
+// max, which is all weft_run_parallel() needs to combine carries.
+#define scan_add(T,x,y) (T)((x) + (y))
+#define scan_max(T,x,y) ((x) < (y) ? (y) : (x))
+#define SCAN(name, B, T, op, bias)                                                              \
+    stage(name) {                                                                               \
+        T *r=R, *x=v(x);                                                                        \
+        uint64_t* carry = (uint64_t*)((char*)V + (uint32_t)inst->imm);                          \
+        memcpy(r, x, sizeof(T) * N);                                                            \
+        for (int k = 1; k < N; k *= 2) {                                                        \
+            for (int i = N; i --> k;) { r[i] = op(T, r[i-k], r[i]); }                           \
+        }                                                                                       \
+        T const c = (T)(uint##B##_t)((uint##B##_t)*carry ^ (bias));                             \
+        each r[i] = op(T, c, r[i]);                                                             \
+        *carry = (uint##B##_t)((uint##B##_t)r[tail ? tail-1 : N-1] ^ (bias));                   \
+        next(r+N);                                                                              \
+    }
+#define SCAN_STAGES(B,S,U)                                                                      \
+    SCAN(scan_add_##B  , B, U, scan_add, 0)                                                     \
+    SCAN(scan_max_u##B , B, U, scan_max, 0)                                                     \
+    SCAN(scan_max_s##B , B, S, scan_max, (uint##B##_t)1 << (B-1))                               \
+    V##B weft_scan_add_##B(Builder* b, V##B x) {                                                \
+        assert(b->region == 0);                                                                 \
+        if (is_splat(b,x.id,0)) { return x; }                                                   \
+        return inst(b, LOAD,B,scan_add_##B, .x=x.id, .imm=(int64_t)B << 32);                    \
+    }                                                                                           \
+    V##B weft_scan_max_u##B(Builder* b, V##B x) {                                               \
+        assert(b->region == 0);                                                                 \
+        return inst(b, LOAD,B,scan_max_u##B, .x=x.id, .imm=(int64_t)(256+B) << 32);             \
+    }                                                                                           \
+    V##B weft_scan_max_s##B(Builder* b, V##B x) {                                               \
+        assert(b->region == 0);                                                                 \
+        return inst(b, LOAD,B,scan_max_s##B, .x=x.id, .imm=(int64_t)(256+B) << 32);             \
+    }
+SCAN_STAGES( 8, int8_t, uint8_t)
+SCAN_STAGES(16,int16_t,uint16_t)
+SCAN_STAGES(32,int32_t,uint32_t)
+SCAN_STAGES(64,int64_t,uint64_t)
+
+static bool is_scan(Stage* fn) {
+    return fn == scan_add_8   || fn == scan_add_16   || fn == scan_add_32   || fn == scan_add_64
+        || fn == scan_max_u8  || fn == scan_max_u16  || fn == scan_max_u32  || fn == scan_max_u64
+        || fn == scan_max_s8  || fn == scan_max_s16  || fn == scan_max_s32  || fn == scan_max_s64;
+}
+
+// Fold carry y into x as if y's instances ran after x's.
+static uint64_t combine_carry(int64_t imm, uint64_t x, uint64_t y) {
+    const int      bits = (int)(imm >> 32 & 255);
+    const uint64_t m    = bits == 64 ? ~(uint64_t)0 : ((uint64_t)1 << bits) - 1;
+    return (imm >> 40) ? ((x & m) < (y & m) ? y : x) & m
+                       :  (x + y) & m;
+}
+
+// Histograms add straight into ptr[imm>>32], unless weft_run_parallel() has handed this thread a
+// private Histogram through the state at (uint32_t)imm.  Either way, lanes run in order, so lanes
+// hitting the same bucket all count.
+static uint32_t* histogram_counts(const PInst* inst, void* V, const uint32_t bucket[],
+                                  unsigned tail, void* const ptr[]) {
+    const uint64_t* state = (const uint64_t*)((char*)V + (uint32_t)inst->imm);
+    Histogram* h = (Histogram*)(uintptr_t)*state;
+    if (!h) {
+        return ptr[inst->imm >> 32];
+    }
+    uint64_t len = h->len;
+    for (int i = 0; i < (tail ? (int)tail : N); i++) {
+        len = len > bucket[i] ? len : (uint64_t)bucket[i] + 1;
+    }
+    if (len > h->cap) {
+        const uint64_t cap = len > 2*h->cap ? len : 2*h->cap;
+        h->count = realloc(h->count, sizeof *h->count * (size_t)cap);
+        memset(h->count + h->cap, 0, sizeof *h->count * (size_t)(cap - h->cap));
+        h->cap = cap;
+    }
+    h->len = len;
+    return h->count;
+}
+static void merge_histogram(void* const ptr[], int64_t imm, uint64_t state) {
+    Histogram* h = (Histogram*)(uintptr_t)state;
+    uint32_t* count = ptr[imm >> 32];
+    for (uint64_t i = 0; i < h->len; i++) {
+        count[i] += h->count[i];
+    }
+    free(h->count);
+    free(h);
+}
+
+static void histogram_add_32_(const PInst* inst, unsigned tail, void* V, void* const ptr[]) {
+    const uint32_t *bucket=v(x), *weight=v(y);
+    uint32_t* count = histogram_counts(inst,V,bucket,tail,ptr);
+    for (int i = 0; i < (tail ? (int)tail : N); i++) {
+        count[bucket[i]] += weight[i];
+    }
+}
+stage(histogram_add_32) { (void)off; histogram_add_32_(inst,tail,V,ptr); next(R); }
+stage(histogram_add_32_done) { (void)off; (void)R; histogram_add_32_(inst,tail,V,ptr); }
+
+void weft_histogram_add_32(Builder* b, int ptr, V32 bucket, V32 weight) {
+    if (is_splat(b,weight.id,0)) { return; }
+    (void)inst(b,SIDE_EFFECT,0,histogram_add_32, .done=histogram_add_32_done
+                                               , .x=bucket.id, .y=weight.id
+                                               , .imm=(int64_t)use_ptr(b,ptr) << 32);
+}
+
+static bool is_histogram(Stage* fn) {
+    return fn == histogram_add_32;
+}
+
+// Polynomial approximations of exp, log, sin, cos and pow.  They're written with only arithmetic,
+// comparisons and bit-casts so the compiler can vectorize stages that call them across all N lanes.
+// Float sin, cos and pow work in double internally.  Error bounds are documented in weft.h.
+// The double exp and log are marked inline so they still inline into every pow_f* stage.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wfloat-equal"
+static float   f32_from_bits(int32_t b) { float   f; memcpy(&f, &b, sizeof f); return f; }
+static double  f64_from_bits(int64_t b) { double  f; memcpy(&f, &b, sizeof f); return f; }
+static int32_t bits_from_f32(float   f) { int32_t b; memcpy(&b, &f, sizeof b); return b; }
+static int64_t bits_from_f64(double  f) { int64_t b; memcpy(&b, &f, sizeof b); return b; }
+
+static float poly_exp_float(float x) {
+    // Clamping keeps k's two halves in normal range; NaN passes through both comparisons.
+    x = x < -104.0f ? -104.0f : x;
+    x = x >   89.0f ?   89.0f : x;
+
+    // x = k*ln2 + r, |r| <= ln2/2.  Adding 0x1.8p23 rounds k to an integer in t's low bits.
+    const float t = x * 1.44269504f + 0x1.8p23f,
+                k = t - 0x1.8p23f,
+                r = (x - k*0.693145751953125f) - k*1.42860677e-6f;
+    const int32_t ki = bits_from_f32(t) - bits_from_f32(0x1.8p23f),
+                  k1 = ki >> 1,
+                  k2 = ki - k1;
+
+    float p = 1/5040.0f;
+    p = p*r + 1/720.0f;
+    p = p*r + 1/120.0f;
+    p = p*r + 1/24.0f;
+    p = p*r + 1/6.0f;
+    p = p*r + 1/2.0f;
+    p = p*r + 1;
+    p = p*r + 1;
+    return p * f32_from_bits((k1+127) << 23)
+             * f32_from_bits((k2+127) << 23);
+}
+static inline double poly_exp_double(double x) {
+    x = x < -746.0 ? -746.0 : x;
+    x = x >  710.0 ?  710.0 : x;
+
+    const double t = x * 1.4426950408889634 + 0x1.8p52,
+                 k = t - 0x1.8p52,
+                 r = (x - k*6.93147180369123816490e-01) - k*1.90821492927058770002e-10;
+    // Split k in halves the same way, avoiding 64-bit shifts and conversions SIMD may lack.
+    const double  h  = k*0.5 + 0x1.8p52;
+    const int64_t k1 = bits_from_f64(h) - bits_from_f64(0x1.8p52),
+                  k2 = bits_from_f64(t) - bits_from_f64(h);
+
+    double p = 1/6227020800.0;
+    p = p*r + 1/479001600.0;
+    p = p*r + 1/39916800.0;
+    p = p*r + 1/3628800.0;
+    p = p*r + 1/362880.0;
+    p = p*r + 1/40320.0;
+    p = p*r + 1/5040.0;
+    p = p*r + 1/720.0;
+    p = p*r + 1/120.0;
+    p = p*r + 1/24.0;
+    p = p*r + 1/6.0;
+    p = p*r + 1/2.0;
+    p = p*r + 1;
+    p = p*r + 1;
+    return p * f64_from_bits((k1+1023) << 52)
+             * f64_from_bits((k2+1023) << 52);
+}
+
+static float poly_log_float(float x) {
+    // Scale denormals up into normal range so their exponent bits mean something.
+    const bool  tiny = x < 0x1p-126f;
+    const float y    = tiny ? x * 0x1p24f : x;
+
+    // y = 2^e * m, with m in [sqrt(1/2), sqrt(2)).
+    const int32_t bits = bits_from_f32(y) + (bits_from_f32(1.0f) - bits_from_f32(0.70710678f));
+    const float   e    = (float)((bits >> 23) - 127 - (tiny ? 24 : 0)),
+                  m    = f32_from_bits((bits & 0x007fffff) + bits_from_f32(0.70710678f));
+
+    // log(m) = 2*atanh(s) = 2s(1 + s^2/3 + s^4/5 + ...), with s = (m-1)/(m+1), |s| < 0.172.
+    const float s = (m-1) / (m+1),
+                z = s*s;
+    float p = 2/9.0f;
+    p = p*z + 2/7.0f;
+    p = p*z + 2/5.0f;
+    p = p*z + 2/3.0f;
+    p = p*z;
+    const float l = e*0.693145751953125f + (e*1.42860677e-6f + (2*s + s*p));
+
+    return isnan(x) || x < 0 ? (float)NAN
+         : x == 0          ? -(float)INFINITY
+         : isinf(x)        ? x
+         :                   l;
+}
+// x = 2^e * m, with m in [sqrt(1/2), sqrt(2)); returns e.
+static inline double log_reduce_double(double x, double* m) {
+    const bool   tiny = x < 0x1p-1022;
+    const double y    = tiny ? x * 0x1p54 : x;
+
+    const int64_t half = bits_from_f64(0.70710678118654752),
+                  bits = bits_from_f64(y) + (bits_from_f64(1.0) - half);
+    *m = f64_from_bits((bits & 0x000fffffffffffff) + half);
+    return f64_from_bits((int64_t)((uint64_t)bits >> 52) | bits_from_f64(0x1p52))
+         - (0x1p52 + 1023 + (tiny ? 54 : 0));
+}
+static inline double poly_log_double(double x) {
+    double m;
+    const double e = log_reduce_double(x, &m);
+
+    const double s = (m-1) / (m+1),
+                 z = s*s;
+    double p = 2/21.0;
+    p = p*z + 2/19.0;
+    p = p*z + 2/17.0;
+    p = p*z + 2/15.0;
+    p = p*z + 2/13.0;
+    p = p*z + 2/11.0;
+    p = p*z + 2/9.0;
+    p = p*z + 2/7.0;
+    p = p*z + 2/5.0;
+    p = p*z + 2/3.0;
+    p = p*z;
+    const double l = e*6.93147180369123816490e-01 + (e*1.90821492927058770002e-10 + (2*s + s*p));
+
+    return isnan(x) || x < 0 ? (double)NAN
+         : x == 0          ? -(double)INFINITY
+         : isinf(x)        ? x
+         :                   l;
+}
+
+// a+b and a*b exactly, as a double and the *lo it rounded off.  two_prod() splits each factor
+// into halves of 26 bits whose products are exact, so it needs no FMA, only |a|,|b| < 2^996.
+static inline double two_sum(double a, double b, double* lo) {
+    const double s = a + b,
+                 v = s - a;
+    *lo = (a - (s - v)) + (b - v);
+    return s;
+}
+static inline double two_prod(double a, double b, double* lo) {
+    const double p  = a * b,
+                 ca = a * 134217729.0, ah = ca - (ca - a), al = a - ah,
+                 cb = b * 134217729.0, bh = cb - (cb - b), bl = b - bh;
+    *lo = ((ah*bh - p) + ah*bl + al*bh) + al*bl;
+    return p;
+}
+
+// An error of d in y*log(x) is a relative error of d in exp(y*log(x)), so rounding y*log(x) to a
+// double alone would cost hundreds of ulp as |y*log(x)| nears 709.  So log(x) and its product
+// with y carry a low double of the bits that rounding drops, folded in as exp(h+l) = exp(h)*(1+l).
+static inline double poly_pow_double(double x, double y) {
+    double m;
+    const double e = log_reduce_double(x, &m);
+
+    // s = (m-1)/(m+1) + sl, with m-1 exact and m+1 = d + dl.
+    double dl, pl;
+    const double f  = m - 1,
+                 d  = two_sum(m, 1, &dl),
+                 s  = f / d,
+                 p  = two_prod(s, d, &pl),
+                 sl = (((f - p) - pl) - s*dl) / d;
+
+    // log(m) = 2s + 2/3 s^3 + s^5*q.  The first two terms are large enough to need their low bits
+    // too, so 2/3 s^3 = c + cl, with 2/3 itself split in two.
+    double zl, s3l, cl;
+    const double z  = two_prod(s, s, &zl),
+                 s3 = two_prod(z, s, &s3l),
+                 c  = two_prod(0x1.5555555555555p-1, s3, &cl);
+    cl += 0x1.5555555555555p-1 * (s3l + zl*s) + 3.700743415417188e-17 * s3;
+    double q = 2/23.0;
+    q = q*z + 2/21.0;
+    q = q*z + 2/19.0;
+    q = q*z + 2/17.0;
+    q = q*z + 2/15.0;
+    q = q*z + 2/13.0;
+    q = q*z + 2/11.0;
+    q = q*z + 2/9.0;
+    q = q*z + 2/7.0;
+    q = q*z + 2/5.0;
+    q = q*z*z*s;
+
+    // log(x) = e*ln2 + log(m) = l + ll, where e times ln2's high half and 2s are exact.
+    double tl, ul;
+    const double t  = two_sum(e*6.93147180369123816490e-01, 2*s, &tl),
+                 u  = two_sum(t, c, &ul),
+                 lo = tl + ul + (e*1.90821492927058770002e-10 + cl + (2*sl + 2*z*sl + q)),
+                 l  = isnan(x) || x < 0 ? (double)NAN
+                    : x == 0          ? -(double)INFINITY
+                    : isinf(x)        ? x
+                    :                   u + lo,
+                 ll = lo - (l - u);
+
+    // y*log(x) = h + hl.  Only finite, non-zero results need the correction, and hl may not be
+    // finite past |h| >= 1024.
+    double hl;
+    const double h = two_prod(y, l, &hl),
+                 r = poly_exp_double(h);
+    return fabs(h) < 1024 && r < (double)INFINITY ? r + r*(hl + y*ll) : r;
+}
+// A plain double has bits enough to spare for f32 and f16.
+static float poly_pow_float(float x, float y) {
+    return (float)poly_exp_double((double)y * poly_log_double((double)x));
+}
+
+// sin(x) when quadrant is even, cos(x) when odd, for x = quadrant*pi/2 + r.
+static double poly_sincos_double(double x, int64_t quadrant_bias) {
+    // pi/2 split three ways; the first two have 33 bits, keeping q*pi/2 exact for |q| < 2^20.
+    const double t = x * 0.63661977236758134 + 0x1.8p52,
+                 q = t - 0x1.8p52,
+                 r = ((x - q*1.57079632673412561417e+00)
+                         - q*6.07710050630396597660e-11)
+                         - q*2.02226624871116645580e-21,
+                 z = r*r;
+    const int64_t quadrant = bits_from_f64(t) - bits_from_f64(0x1.8p52) + quadrant_bias;
+
+    double s = -1/121645100408832000.0;
+    s = s*z + 1/355687428096000.0;
+    s = s*z - 1/1307674368000.0;
+    s = s*z + 1/6227020800.0;
+    s = s*z - 1/39916800.0;
+    s = s*z + 1/362880.0;
+    s = s*z - 1/5040.0;
+    s = s*z + 1/120.0;
+    s = s*z - 1/6.0;
+    s = s*z*r + r;
+
+    double c = 1/6402373705728000.0;
+    c = c*z - 1/20922789888000.0;
+    c = c*z + 1/87178291200.0;
+    c = c*z - 1/479001600.0;
+    c = c*z + 1/3628800.0;
+    c = c*z - 1/40320.0;
+    c = c*z + 1/720.0;
+    c = c*z - 1/24.0;
+    c = c*z + 1/2.0;
+    c = 1 - c*z;
+
+    const double v = (quadrant & 1) ? c : s;
+    return (quadrant & 2) ? -v : v;
+}
+static double poly_sin_double(double x) { return poly_sincos_double(x, 0); }
+static double poly_cos_double(double x) { return poly_sincos_double(x, 1); }
+static float  poly_sin_float (float  x) { return (float)poly_sincos_double((double)x, 0); }
+static float  poly_cos_float (float  x) { return (float)poly_sincos_double((double)x, 1); }
+
+#pragma GCC diagnostic pop
+
+#if defined(__aarch64__)
+    JIT_SIMD3(min_s8 , 8,0,0,0x0d)  JIT_SIMD3(max_s8 , 8,0,0,0x0c)  JIT_SIMD2(abs_s8 , 8,0,0,0x0b)
+    JIT_SIMD3(min_s16,16,0,1,0x0d)  JIT_SIMD3(max_s16,16,0,1,0x0c)  JIT_SIMD2(abs_s16,16,0,1,0x0b)
+    JIT_SIMD3(min_s32,32,0,2,0x0d)  JIT_SIMD3(max_s32,32,0,2,0x0c)  JIT_SIMD2(abs_s32,32,0,2,0x0b)
+    JIT_SIMD3(min_u8 , 8,1,0,0x0d)  JIT_SIMD3(max_u8 , 8,1,0,0x0c)  JIT_SIMD2(abs_s64,64,0,3,0x0b)
+    JIT_SIMD3(min_u16,16,1,1,0x0d)  JIT_SIMD3(max_u16,16,1,1,0x0c)
+    JIT_SIMD3(min_u32,32,1,2,0x0d)  JIT_SIMD3(max_u32,32,1,2,0x0c)
+    JIT_SIMD3(avg_u8 , 8,1,0,0x02)  JIT_SIMD3(avg_u16,16,1,1,0x02)
+
+    // cnt only counts bytes, and there's no 64-bit clz.
+    JIT_SIMD2(popcnt_8, 8,0,0,0x05)  JIT_SIMD2(clz_8, 8,1,0,0x04)
+    JIT_SIMD2(clz_16,16,1,1,0x04)    JIT_SIMD2(clz_32,32,1,2,0x04)
+
+    // fminnm/fmaxnm match fmin()/fmax()'s NaN handling.
+    JIT_SIMD3(min_f32,32,0,2,0x18)  JIT_SIMD3(max_f32,32,0,0,0x18)  JIT_SIMD2(abs_f32,32,0,2,0x0f)
+    JIT_SIMD3(min_f64,64,0,3,0x18)  JIT_SIMD3(max_f64,64,0,1,0x18)  JIT_SIMD2(abs_f64,64,0,3,0x0f)
+
+    // frecpe/frsqrte, used only when there are no refinement steps.
+    JIT_SIMD2(rcp_approx_f32,32,0,2,0x1d)  JIT_SIMD2(rsqrt_approx_f32,32,1,2,0x1d)
+
+    // frintn, and fcvtns/fcvtzs, which saturate and convert NaN to 0 just like sat_32/64().
+    JIT_SIMD2(round_f32,32,0,0,0x18)  JIT_SIMD2(cvt_nearest_f32,32,0,0,0x1a)
+    JIT_SIMD2(round_f64,64,0,1,0x18)  JIT_SIMD2(cvt_nearest_f64,64,0,1,0x1a)
+    JIT_SIMD2(cvt_trunc_f32,32,0,2,0x1b)
+    JIT_SIMD2(cvt_trunc_f64,64,0,3,0x1b)
+#else
+    #define jit_min_s8  NULL
+    #define jit_min_s16 NULL
+    #define jit_min_s32 NULL
+    #define jit_min_u8  NULL
+    #define jit_min_u16 NULL
+    #define jit_min_u32 NULL
+    #define jit_max_s8  NULL
+    #define jit_max_s16 NULL
+    #define jit_max_s32 NULL
+    #define jit_max_u8  NULL
+    #define jit_max_u16 NULL
+    #define jit_max_u32 NULL
+    #define jit_abs_s8  NULL
+    #define jit_abs_s16 NULL
+    #define jit_abs_s32 NULL
+    #define jit_abs_s64 NULL
+    #define jit_avg_u8  NULL
+    #define jit_avg_u16 NULL
+    #define jit_popcnt_8 NULL
+    #define jit_clz_8   NULL
+    #define jit_clz_16  NULL
+    #define jit_clz_32  NULL
+    #define jit_min_f32 NULL
+    #define jit_max_f32 NULL
+    #define jit_abs_f32 NULL
+    #define jit_rcp_approx_f32   NULL
+    #define jit_rsqrt_approx_f32 NULL
+    #define jit_round_f32       NULL
+    #define jit_round_f64       NULL
+    #define jit_cvt_nearest_f32 NULL
+    #define jit_cvt_nearest_f64 NULL
+    #define jit_cvt_trunc_f32   NULL
+    #define jit_cvt_trunc_f64   NULL
+    #define jit_min_f64 NULL
+    #define jit_max_f64 NULL
+    #define jit_abs_f64 NULL
+#endif
+// There are no NEON 64-bit integer min/max instructions, and we don't JIT half floats yet.
+#define jit_min_s64 NULL
+#define jit_min_u64 NULL
+#define jit_max_s64 NULL
+#define jit_max_u64 NULL
+#define jit_popcnt_16 NULL
+#define jit_popcnt_32 NULL
+#define jit_popcnt_64 NULL
+#define jit_clz_64    NULL
+#define jit_min_f16 NULL
+#define jit_max_f16 NULL
+#define jit_abs_f16 NULL
+#define jit_round_f16 NULL
+#define jit_cvt_nearest_f16 NULL
+#define jit_cvt_trunc_f16 NULL
+
+// Convert an already-integral x to an int, saturating and mapping NaN to 0.
+#define SAT(B,S,M)                                                                                \
+    static S sat_##B(M x) {                                                                       \
+        const M lo = -2 * (M)((S)1 << (B-2));                                                     \
+        return isnan(x) ? 0 : x >= -lo ? (S)~(S)lo : x <= lo ? (S)lo : (S)x;                      \
+    }
+SAT(16,int16_t,float)
+SAT(32,int32_t,float)
+SAT(64,int64_t,double)
+
 #define FLOAT_STAGES(B,S,F,M,N0,P1) \
     stage( cast_f##B){S *r=R; F *x=v(x);          each r[i]=(S)   x[i]              ; next(r+N);} \
     stage( cast_s##B){F *r=R; S *x=v(x);          each r[i]=(F)(M)x[i]              ; next(r+N);} \
     stage( ceil_f##B){F *r=R,   *x=v(x);          each r[i]=(F)ceil ((M)x[i])       ; next(r+N);} \
     stage(floor_f##B){F *r=R,   *x=v(x);          each r[i]=(F)floor((M)x[i])       ; next(r+N);} \
+    stage(round_f##B){F *r=R,   *x=v(x);          each r[i]=(F)rint ((M)x[i])       ; next(r+N);} \
+    stage(cvt_nearest_f##B){S *r=R; F *x=v(x); each r[i]=sat_##B(rint ((M)x[i])); next(r+N);}     \
+    stage(cvt_trunc_f##B)  {S *r=R; F *x=v(x); each r[i]=sat_##B(trunc((M)x[i])); next(r+N);}     \
     stage( sqrt_f##B){F *r=R,   *x=v(x);          each r[i]=(F)sqrt ((M)x[i])       ; next(r+N);} \
     stage(  add_f##B){F *r=R,   *x=v(x), *y=v(y); each r[i]=(F)((M)x[i] + (M)y[i])  ; next(r+N);} \
     stage(  sub_f##B){F *r=R,   *x=v(x), *y=v(y); each r[i]=(F)((M)x[i] - (M)y[i])  ; next(r+N);} \
@@ -532,12 +2193,44 @@ static void sort_commutative(int* x, int* y) {
     stage(   eq_f##B){S *r=R; F *x=v(x), *y=v(y); each r[i]=(M)x[i] == (M)y[i] ?-1:0; next(r+N);} \
     stage(   lt_f##B){S *r=R; F *x=v(x), *y=v(y); each r[i]=(M)x[i] <  (M)y[i] ?-1:0; next(r+N);} \
     stage(   le_f##B){S *r=R; F *x=v(x), *y=v(y); each r[i]=(M)x[i] <= (M)y[i] ?-1:0; next(r+N);} \
+    stage(  min_f##B){F *r=R,   *x=v(x), *y=v(y); each r[i]=(F)fmin((M)x[i], (M)y[i]); next(r+N);} \
+    stage(  max_f##B){F *r=R,   *x=v(x), *y=v(y); each r[i]=(F)fmax((M)x[i], (M)y[i]); next(r+N);} \
+    stage(  abs_f##B){F *r=R,   *x=v(x);          each r[i]=(F)fabs((M)x[i])        ; next(r+N);} \
+    stage(  exp_f##B){F *r=R,   *x=v(x);          each r[i]=(F)poly_exp_##M((M)x[i]); next(r+N);} \
+    stage(  log_f##B){F *r=R,   *x=v(x);          each r[i]=(F)poly_log_##M((M)x[i]); next(r+N);} \
+    stage(  sin_f##B){F *r=R,   *x=v(x);          each r[i]=(F)poly_sin_##M((M)x[i]); next(r+N);} \
+    stage(  cos_f##B){F *r=R,   *x=v(x);          each r[i]=(F)poly_cos_##M((M)x[i]); next(r+N);} \
+    stage(  pow_f##B){F *r=R,   *x=v(x), *y=v(y);                                                 \
+        each r[i] = (M)y[i] == 0 || (M)x[i] == 1 ? (F)1 : (F)poly_pow_##M((M)x[i], (M)y[i]);      \
+        next(r+N);                                                                                \
+    }                                                                                             \
                                                                                                   \
     V##B weft_cast_f##B (Builder* b, V##B x) { return inst(b,MATH,B, cast_f##B, .x=x.id); }       \
     V##B weft_cast_s##B (Builder* b, V##B x) { return inst(b,MATH,B, cast_s##B, .x=x.id); }       \
     V##B weft_ceil_f##B (Builder* b, V##B x) { return inst(b,MATH,B, ceil_f##B, .x=x.id); }       \
     V##B weft_floor_f##B(Builder* b, V##B x) { return inst(b,MATH,B,floor_f##B, .x=x.id); }       \
+    V##B weft_round_f##B(Builder* b, V##B x) {                                                    \
+        Stage* const fn = b->inst[x.id-1].fn;                                                     \
+        if (fn == round_f##B || fn == ceil_f##B || fn == floor_f##B) { return x; }                \
+        return inst(b, MATH,B, round_f##B, .x=x.id, .jit=jit_round_f##B);                         \
+    }                                                                                             \
+    V##B weft_cvt_nearest_f##B(Builder* b, V##B x) {                                              \
+        return inst(b, MATH,B, cvt_nearest_f##B, .x=x.id, .jit=jit_cvt_nearest_f##B);             \
+    }                                                                                             \
+    V##B weft_cvt_trunc_f##B(Builder* b, V##B x) {                                                \
+        return inst(b, MATH,B, cvt_trunc_f##B, .x=x.id, .jit=jit_cvt_trunc_f##B);                 \
+    }                                                                                             \
     V##B weft_sqrt_f##B (Builder* b, V##B x) { return inst(b,MATH,B, sqrt_f##B, .x=x.id); }       \
+    V##B weft_exp_f##B  (Builder* b, V##B x) { return inst(b,MATH,B,  exp_f##B, .x=x.id); }       \
+    V##B weft_log_f##B  (Builder* b, V##B x) { return inst(b,MATH,B,  log_f##B, .x=x.id); }       \
+    V##B weft_sin_f##B  (Builder* b, V##B x) { return inst(b,MATH,B,  sin_f##B, .x=x.id); }       \
+    V##B weft_cos_f##B  (Builder* b, V##B x) { return inst(b,MATH,B,  cos_f##B, .x=x.id); }       \
+    V##B weft_pow_f##B(Builder* b, V##B x, V##B y) {                                              \
+        if (is_splat(b,y.id,     0)) { return weft_splat_##B(b, (S)P1); }                         \
+        if (is_splat(b,y.id, (S)N0)) { return weft_splat_##B(b, (S)P1); }                         \
+        if (is_splat(b,y.id,     P1)) { return x; }                                               \
+        return inst(b, MATH,B, pow_f##B, .x=x.id, .y=y.id);                                       \
+    }                                                                                             \
     V##B weft_add_f##B(Builder* b, V##B x, V##B y) {                                              \
         sort_commutative(&x.id, &y.id);                                                           \
         if (is_splat(b,y.id,     0)) { return x; }                                                \
@@ -566,6 +2259,20 @@ static void sort_commutative(int* x, int* y) {
                                                   return inst(b,MATH,B,eq_f##B,.x=x.id,.y=y.id);} \
     V##B weft_lt_f##B(Builder* b, V##B x, V##B y){return inst(b,MATH,B,lt_f##B,.x=x.id,.y=y.id);} \
     V##B weft_le_f##B(Builder* b, V##B x, V##B y){return inst(b,MATH,B,le_f##B,.x=x.id,.y=y.id);} \
+    V##B weft_min_f##B(Builder* b, V##B x, V##B y) {                                              \
+        sort_commutative(&x.id, &y.id);                                                           \
+        if (x.id == y.id) { return x; }                                                           \
+        return inst(b, MATH,B, min_f##B, .x=x.id, .y=y.id, .jit=jit_min_f##B);                    \
+    }                                                                                             \
+    V##B weft_max_f##B(Builder* b, V##B x, V##B y) {                                              \
+        sort_commutative(&x.id, &y.id);                                                           \
+        if (x.id == y.id) { return x; }                                                           \
+        return inst(b, MATH,B, max_f##B, .x=x.id, .y=y.id, .jit=jit_max_f##B);                    \
+    }                                                                                             \
+    V##B weft_abs_f##B(Builder* b, V##B x) {                                                      \
+        if (b->inst[x.id-1].fn == abs_f##B) { return x; }                                         \
+        return inst(b, MATH,B, abs_f##B, .x=x.id, .jit=jit_abs_f##B);                             \
+    }                                                                                             \
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wfloat-equal"
@@ -574,6 +2281,88 @@ static void sort_commutative(int* x, int* y) {
     FLOAT_STAGES(64,int64_t,double,double, 0x8000000000000000, 0x3ff0000000000000)
 #pragma GCC diagnostic pop
 
+// Each estimate takes N floats at a time, 4 per SIMD register.
+static void rcp_estimate(float e[N], const float x[N]) {
+#if defined(__SSE__)
+    for (int i = 0; i < N; i += 4) { _mm_storeu_ps(e+i, _mm_rcp_ps(_mm_loadu_ps(x+i))); }
+#elif defined(__ARM_NEON)
+    for (int i = 0; i < N; i += 4) { vst1q_f32(e+i, vrecpeq_f32(vld1q_f32(x+i))); }
+#else
+    each e[i] = 1/x[i];
+#endif
+}
+static void rsqrt_estimate(float e[N], const float x[N]) {
+#if defined(__SSE__)
+    for (int i = 0; i < N; i += 4) { _mm_storeu_ps(e+i, _mm_rsqrt_ps(_mm_loadu_ps(x+i))); }
+#elif defined(__ARM_NEON)
+    for (int i = 0; i < N; i += 4) { vst1q_f32(e+i, vrsqrteq_f32(vld1q_f32(x+i))); }
+#else
+    each e[i] = 1/sqrt(x[i]);
+#endif
+}
+
+// Newton-Raphson steps would turn the estimates 0 and inf into NaN, so we only refine normal e.
+static void rcp_refine(float e[N], const float x[N], int64_t steps) {
+    while (steps --> 0) {
+        each e[i] = isnormal(e[i]) ? e[i] * (2 - x[i]*e[i]) : e[i];
+    }
+}
+static void rsqrt_refine(float e[N], const float x[N], int64_t steps) {
+    while (steps --> 0) {
+        each e[i] = isnormal(e[i]) ? e[i] * (1.5f - 0.5f*x[i]*e[i]*e[i]) : e[i];
+    }
+}
+
+stage(rcp_approx_f32) {
+    float *r=R, *x=v(x);
+    rcp_estimate(r,x);
+    rcp_refine  (r,x, inst->imm);
+    next(r+N);
+}
+stage(rsqrt_approx_f32) {
+    float *r=R, *x=v(x);
+    rsqrt_estimate(r,x);
+    rsqrt_refine  (r,x, inst->imm);
+    next(r+N);
+}
+stage(rcp_approx_f16) {
+    __fp16 *r=R, *x=v(x);
+    float e[N], f[N];
+    each f[i] = (float)x[i];
+    rcp_estimate(e,f);
+    rcp_refine  (e,f, inst->imm);
+    each r[i] = (__fp16)e[i];
+    next(r+N);
+}
+stage(rsqrt_approx_f16) {
+    __fp16 *r=R, *x=v(x);
+    float e[N], f[N];
+    each f[i] = (float)x[i];
+    rsqrt_estimate(e,f);
+    rsqrt_refine  (e,f, inst->imm);
+    each r[i] = (__fp16)e[i];
+    next(r+N);
+}
+
+V16 weft_rcp_approx_f16(Builder* b, V16 x, int steps) {
+    assert(steps >= 0);
+    return inst(b, MATH,16, rcp_approx_f16, .x=x.id, .imm=steps);
+}
+V16 weft_rsqrt_approx_f16(Builder* b, V16 x, int steps) {
+    assert(steps >= 0);
+    return inst(b, MATH,16, rsqrt_approx_f16, .x=x.id, .imm=steps);
+}
+V32 weft_rcp_approx_f32(Builder* b, V32 x, int steps) {
+    assert(steps >= 0);
+    return inst(b, MATH,32, rcp_approx_f32, .x=x.id, .imm=steps
+                                          , .jit=steps ? NULL : jit_rcp_approx_f32);
+}
+V32 weft_rsqrt_approx_f32(Builder* b, V32 x, int steps) {
+    assert(steps >= 0);
+    return inst(b, MATH,32, rsqrt_approx_f32, .x=x.id, .imm=steps
+                                            , .jit=steps ? NULL : jit_rsqrt_approx_f32);
+}
+
 #define INT_STAGES(B,S,U) \
     stage(not_  ##B) {S *r=R, *x=v(x);          each r[i] =     ~x[i]            ; next(r+N);}  \
     stage(shli_i##B) {S *r=R, *x=v(x);          each r[i] =  (S)(x[i]<<inst->imm); next(r+N);}  \
@@ -594,6 +2383,11 @@ static void sort_commutative(int* x, int* y) {
     stage(lt_u  ##B) {U *r=R, *x=v(x), *y=v(y); each r[i] = x[i]< y[i] ?(U)-1 : 0; next(r+N);}  \
     stage(le_s  ##B) {S *r=R, *x=v(x), *y=v(y); each r[i] = x[i]<=y[i] ?   -1 : 0; next(r+N);}  \
     stage(le_u  ##B) {U *r=R, *x=v(x), *y=v(y); each r[i] = x[i]<=y[i] ?(U)-1 : 0; next(r+N);}  \
+    stage(min_s ##B) {S *r=R, *x=v(x), *y=v(y); each r[i] = x[i]< y[i] ? x[i]:y[i]; next(r+N);}  \
+    stage(min_u ##B) {U *r=R, *x=v(x), *y=v(y); each r[i] = x[i]< y[i] ? x[i]:y[i]; next(r+N);}  \
+    stage(max_s ##B) {S *r=R, *x=v(x), *y=v(y); each r[i] = x[i]< y[i] ? y[i]:x[i]; next(r+N);}  \
+    stage(max_u ##B) {U *r=R, *x=v(x), *y=v(y); each r[i] = x[i]< y[i] ? y[i]:x[i]; next(r+N);}  \
+    stage(abs_s ##B) {U *r=R; S *x=v(x); each r[i] = x[i] < 0 ? -(U)x[i] : (U)x[i]; next(r+N);}  \
     stage(sel_  ##B) {                                                                          \
         U *r=R, *x=v(x), *y=v(y), *z=v(z);                                                      \
         each r[i] = ( x[i] & y[i])                                                              \
@@ -695,12 +2489,135 @@ static void sort_commutative(int* x, int* y) {
         if (x.id == y.id) { return weft_splat_##B(b,-1); }                                      \
         return inst(b, MATH,B,le_u##B, .x=x.id, .y=y.id);                                       \
     }                                                                                           \
+    V##B weft_min_s##B(Builder* b, V##B x, V##B y) {                                            \
+        const S lo = (S)((U)1 << (B-1)), hi = (S)~lo;                                           \
+        sort_commutative(&x.id, &y.id);                                                         \
+        if (x.id == y.id)        { return x; }                                                  \
+        if (is_splat(b,y.id,lo)) { return y; }                                                  \
+        if (is_splat(b,x.id,lo)) { return x; }                                                  \
+        if (is_splat(b,y.id,hi)) { return x; }                                                  \
+        if (is_splat(b,x.id,hi)) { return y; }                                                  \
+        return inst(b, MATH,B,min_s##B, .x=x.id, .y=y.id, .jit=jit_min_s##B);                   \
+    }                                                                                           \
+    V##B weft_max_s##B(Builder* b, V##B x, V##B y) {                                            \
+        const S lo = (S)((U)1 << (B-1)), hi = (S)~lo;                                           \
+        sort_commutative(&x.id, &y.id);                                                         \
+        if (x.id == y.id)        { return x; }                                                  \
+        if (is_splat(b,y.id,lo)) { return x; }                                                  \
+        if (is_splat(b,x.id,lo)) { return y; }                                                  \
+        if (is_splat(b,y.id,hi)) { return y; }                                                  \
+        if (is_splat(b,x.id,hi)) { return x; }                                                  \
+        return inst(b, MATH,B,max_s##B, .x=x.id, .y=y.id, .jit=jit_max_s##B);                   \
+    }                                                                                           \
+    V##B weft_min_u##B(Builder* b, V##B x, V##B y) {                                            \
+        sort_commutative(&x.id, &y.id);                                                         \
+        if (x.id == y.id)        { return x; }                                                  \
+        if (is_splat(b,y.id, 0)) { return y; }                                                  \
+        if (is_splat(b,x.id, 0)) { return x; }                                                  \
+        if (is_splat(b,y.id,-1)) { return x; }                                                  \
+        if (is_splat(b,x.id,-1)) { return y; }                                                  \
+        return inst(b, MATH,B,min_u##B, .x=x.id, .y=y.id, .jit=jit_min_u##B);                   \
+    }                                                                                           \
+    V##B weft_max_u##B(Builder* b, V##B x, V##B y) {                                            \
+        sort_commutative(&x.id, &y.id);                                                         \
+        if (x.id == y.id)        { return x; }                                                  \
+        if (is_splat(b,y.id, 0)) { return x; }                                                  \
+        if (is_splat(b,x.id, 0)) { return y; }                                                  \
+        if (is_splat(b,y.id,-1)) { return y; }                                                  \
+        if (is_splat(b,x.id,-1)) { return x; }                                                  \
+        return inst(b, MATH,B,max_u##B, .x=x.id, .y=y.id, .jit=jit_max_u##B);                   \
+    }                                                                                           \
+    V##B weft_abs_s##B(Builder* b, V##B x) {                                                    \
+        if (b->inst[x.id-1].fn == abs_s##B) { return x; }                                       \
+        return inst(b, MATH,B,abs_s##B, .x=x.id, .jit=jit_abs_s##B);                            \
+    }                                                                                           \
 
 INT_STAGES( 8, int8_t, uint8_t)
 INT_STAGES(16,int16_t,uint16_t)
 INT_STAGES(32,int32_t,uint32_t)
 INT_STAGES(64,int64_t,uint64_t)
 
+#define BIT_STAGES(B,U)                                                                         \
+    stage(popcnt_##B) {                                                                         \
+        U *r=R, *x=v(x);                                                                        \
+        each r[i] = (U)__builtin_popcountll(x[i]);                                              \
+        next(r+N);                                                                              \
+    }                                                                                           \
+    stage(clz_##B) {                                                                            \
+        U *r=R, *x=v(x);                                                                        \
+        each r[i] = x[i] ? (U)(__builtin_clzll(x[i]) - (64-B)) : B;                            \
+        next(r+N);                                                                              \
+    }                                                                                           \
+    stage(ctz_##B) {                                                                            \
+        U *r=R, *x=v(x);                                                                        \
+        each r[i] = x[i] ? (U)__builtin_ctzll(x[i]) : B;                                        \
+        next(r+N);                                                                              \
+    }                                                                                           \
+    stage(rotli_##B) {                                                                          \
+        U *r=R, *x=v(x);                                                                        \
+        const int n = (int)inst->imm;                                                           \
+        each r[i] = (U)(x[i] << n | x[i] >> (B-n));                                             \
+        next(r+N);                                                                              \
+    }                                                                                           \
+    stage(rotlv_##B) {                                                                          \
+        U *r=R, *x=v(x), *y=v(y);                                                               \
+        each r[i] = (U)(x[i] << (y[i] & (B-1)) | x[i] >> (-y[i] & (B-1)));                      \
+        next(r+N);                                                                              \
+    }                                                                                           \
+    stage(rotrv_##B) {                                                                          \
+        U *r=R, *x=v(x), *y=v(y);                                                               \
+        each r[i] = (U)(x[i] >> (y[i] & (B-1)) | x[i] << (-y[i] & (B-1)));                      \
+        next(r+N);                                                                              \
+    }                                                                                           \
+                                                                                                \
+    V##B weft_popcnt_##B(Builder* b, V##B x) {                                                  \
+        return inst(b, MATH,B,popcnt_##B, .x=x.id, .jit=jit_popcnt_##B);                       \
+    }                                                                                           \
+    V##B weft_clz_##B(Builder* b, V##B x) {                                                     \
+        return inst(b, MATH,B,clz_##B, .x=x.id, .jit=jit_clz_##B);                              \
+    }                                                                                           \
+    V##B weft_ctz_##B(Builder* b, V##B x) { return inst(b, MATH,B,ctz_##B, .x=x.id); }          \
+    V##B weft_rotl_##B(Builder* b, V##B x, V##B y) {                                            \
+        for (int64_t imm; any_splat(b,y.id,&imm);) {                                            \
+            if ((imm & (B-1)) == 0) { return x; }                                               \
+            return inst(b, MATH,B,rotli_##B, .x=x.id, .imm=imm & (B-1));                        \
+        }                                                                                       \
+        return inst(b, MATH,B,rotlv_##B, .x=x.id, .y=y.id);                                     \
+    }                                                                                           \
+    V##B weft_rotr_##B(Builder* b, V##B x, V##B y) {                                            \
+        for (int64_t imm; any_splat(b,y.id,&imm);) {                                            \
+            if ((imm & (B-1)) == 0) { return x; }                                               \
+            return inst(b, MATH,B,rotli_##B, .x=x.id, .imm=-imm & (B-1));                       \
+        }                                                                                       \
+        return inst(b, MATH,B,rotrv_##B, .x=x.id, .y=y.id);                                     \
+    }
+BIT_STAGES( 8, uint8_t)
+BIT_STAGES(16,uint16_t)
+BIT_STAGES(32,uint32_t)
+BIT_STAGES(64,uint64_t)
+
+stage(avg_u8) {
+    uint8_t *r=R, *x=v(x), *y=v(y);
+    each r[i] = (uint8_t)((x[i]+y[i]+1) >> 1);
+    next(r+N);
+}
+stage(avg_u16) {
+    uint16_t *r=R, *x=v(x), *y=v(y);
+    each r[i] = (uint16_t)((x[i]+y[i]+1) >> 1);
+    next(r+N);
+}
+
+V8 weft_avg_u8(Builder* b, V8 x, V8 y) {
+    sort_commutative(&x.id, &y.id);
+    if (x.id == y.id) { return x; }
+    return inst(b, MATH,8,avg_u8, .x=x.id, .y=y.id, .jit=jit_avg_u8);
+}
+V16 weft_avg_u16(Builder* b, V16 x, V16 y) {
+    sort_commutative(&x.id, &y.id);
+    if (x.id == y.id) { return x; }
+    return inst(b, MATH,16,avg_u16, .x=x.id, .y=y.id, .jit=jit_avg_u16);
+}
+
 stage(narrow_i16) { int8_t  *r=R; int16_t *x=v(x); each r[i] = (int8_t )x[i]; next(r+N); }
 stage(narrow_i32) { int16_t *r=R; int32_t *x=v(x); each r[i] = (int16_t)x[i]; next(r+N); }
 stage(narrow_i64) { int32_t *r=R; int64_t *x=v(x); each r[i] = (int32_t)x[i]; next(r+N); }
@@ -731,6 +2648,1320 @@ V64 weft_widen_u32(Builder* b, V32 x) { return inst(b, MATH,64,widen_u32, .x=x.i
 V32 weft_widen_f16(Builder* b, V16 x) { return inst(b, MATH,32,widen_f16, .x=x.id); }
 V64 weft_widen_f32(Builder* b, V32 x) { return inst(b, MATH,64,widen_f32, .x=x.id); }
 
+#define MUL_WIDE_STAGES(B,W,S,U,SW,UW)                                                           \
+    stage(mul_wide_s##B) { SW *r=R; S *x=v(x), *y=v(y); each r[i] = (SW)((SW)x[i] * y[i]);      \
+                           next(r+N); }                                                         \
+    stage(mul_wide_u##B) { UW *r=R; U *x=v(x), *y=v(y); each r[i] = (UW)((UW)x[i] * y[i]);      \
+                           next(r+N); }                                                         \
+    stage(mulhi_s##B) { S *r=R, *x=v(x), *y=v(y); each r[i] = (S)((SW)x[i] * y[i] >> B);        \
+                        next(r+N); }                                                            \
+    stage(mulhi_u##B) { U *r=R, *x=v(x), *y=v(y); each r[i] = (U)((UW)x[i] * y[i] >> B);        \
+                        next(r+N); }                                                            \
+                                                                                                \
+    V##W weft_mul_wide_s##B(Builder* b, V##B x, V##B y) {                                       \
+        sort_commutative(&x.id, &y.id);                                                         \
+        if (is_splat(b,y.id, 0) || is_splat(b,x.id, 0)) { return weft_splat_##W(b,0); }         \
+        if (is_splat(b,y.id, 1)) { return weft_widen_s##B(b,x); }                               \
+        if (is_splat(b,x.id, 1)) { return weft_widen_s##B(b,y); }                               \
+        return inst(b, MATH,W,mul_wide_s##B, .x=x.id, .y=y.id);                                 \
+    }                                                                                           \
+    V##W weft_mul_wide_u##B(Builder* b, V##B x, V##B y) {                                       \
+        sort_commutative(&x.id, &y.id);                                                         \
+        if (is_splat(b,y.id, 0) || is_splat(b,x.id, 0)) { return weft_splat_##W(b,0); }         \
+        if (is_splat(b,y.id, 1)) { return weft_widen_u##B(b,x); }                               \
+        if (is_splat(b,x.id, 1)) { return weft_widen_u##B(b,y); }                               \
+        return inst(b, MATH,W,mul_wide_u##B, .x=x.id, .y=y.id);                                 \
+    }                                                                                           \
+    V##B weft_mulhi_s##B(Builder* b, V##B x, V##B y) {                                          \
+        sort_commutative(&x.id, &y.id);                                                         \
+        if (is_splat(b,y.id, 0)) { return y; }                                                  \
+        if (is_splat(b,x.id, 0)) { return x; }                                                  \
+        return inst(b, MATH,B,mulhi_s##B, .x=x.id, .y=y.id);                                    \
+    }                                                                                           \
+    V##B weft_mulhi_u##B(Builder* b, V##B x, V##B y) {                                          \
+        sort_commutative(&x.id, &y.id);                                                         \
+        if (is_splat(b,y.id, 0)) { return y; }                                                  \
+        if (is_splat(b,x.id, 0)) { return x; }                                                  \
+        if (is_splat(b,y.id, 1)) { return weft_splat_##B(b,0); }                                \
+        if (is_splat(b,x.id, 1)) { return weft_splat_##B(b,0); }                                \
+        return inst(b, MATH,B,mulhi_u##B, .x=x.id, .y=y.id);                                    \
+    }
+MUL_WIDE_STAGES( 8,16, int8_t, uint8_t,int16_t,uint16_t)
+MUL_WIDE_STAGES(16,32,int16_t,uint16_t,int32_t,uint32_t)
+MUL_WIDE_STAGES(32,64,int32_t,uint32_t,int64_t,uint64_t)
+
+// Each 32-bit lane holds two s16 or four 8-bit values; products sum into acc, wrapping.
+static uint32_t dot_s16_lane(uint32_t x, uint32_t y) {
+    return (uint32_t)((int16_t)x       * (int16_t)y      )
+         + (uint32_t)((int16_t)(x>>16) * (int16_t)(y>>16));
+}
+static uint32_t dot_u8s8_lane(uint32_t x, uint32_t y) {
+    int32_t sum = 0;
+    for (int k = 0; k < 32; k += 8) {
+        sum += (uint8_t)(x>>k) * (int8_t)(y>>k);
+    }
+    return (uint32_t)sum;
+}
+stage(dot_s16) {
+    uint32_t *r=R, *x=v(x), *y=v(y), *z=v(z);
+    each r[i] = z[i] + dot_s16_lane(x[i], y[i]);
+    next(r+N);
+}
+stage(dot_u8s8) {
+    uint32_t *r=R, *x=v(x), *y=v(y), *z=v(z);
+    each r[i] = z[i] + dot_u8s8_lane(x[i], y[i]);
+    next(r+N);
+}
+
+V32 weft_dot_s16(Builder* b, V32 x, V32 y, V32 acc) {
+    sort_commutative(&x.id, &y.id);
+    if (is_splat(b,x.id, 0) || is_splat(b,y.id, 0)) { return acc; }
+    return inst(b, MATH,32, dot_s16, .x=x.id, .y=y.id, .z=acc.id);
+}
+V32 weft_dot_u8s8(Builder* b, V32 x, V32 y, V32 acc) {
+    if (is_splat(b,x.id, 0) || is_splat(b,y.id, 0)) { return acc; }
+    return inst(b, MATH,32, dot_u8s8, .x=x.id, .y=y.id, .z=acc.id);
+}
+
+static float f32_from_bf16(uint16_t h) { return f32_from_bits((int32_t)((uint32_t)h << 16)); }
+static uint16_t bf16_from_f32(float f) {
+    const uint32_t bits    = (uint32_t)bits_from_f32(f),
+                   flushed = (bits & 0x7f800000) ? bits : bits & 0x80000000,
+                   rounded = (flushed + 0x7fff + (flushed >> 16 & 1)) >> 16;
+    return isnan(f) ? (uint16_t)(bits >> 16 | 0x40) : (uint16_t)rounded;
+}
+
+stage(widen_bf16)  { float    *r=R; uint16_t *x=v(x); each r[i] = f32_from_bf16(x[i]); next(r+N); }
+stage(narrow_bf16) { uint16_t *r=R; float    *x=v(x); each r[i] = bf16_from_f32(x[i]); next(r+N); }
+
+#define BF16_STAGES(name, op)                                                                     \
+    stage(name##_bf16) {                                                                          \
+        uint16_t *r=R, *x=v(x), *y=v(y);                                                          \
+        each r[i] = bf16_from_f32(f32_from_bf16(x[i]) op f32_from_bf16(y[i]));                    \
+        next(r+N);                                                                                \
+    }
+BF16_STAGES(add, +)
+BF16_STAGES(sub, -)
+BF16_STAGES(mul, *)
+BF16_STAGES(div, /)
+
+V32 weft_widen_bf16 (Builder* b, V16 x) { return inst(b, MATH,32, widen_bf16, .x=x.id); }
+V16 weft_narrow_bf16(Builder* b, V32 x) { return inst(b, MATH,16,narrow_bf16, .x=x.id); }
+
+V16 weft_add_bf16(Builder* b, V16 x, V16 y) {
+    sort_commutative(&x.id, &y.id);
+    return inst(b, MATH,16, add_bf16, .x=x.id, .y=y.id);
+}
+V16 weft_sub_bf16(Builder* b, V16 x, V16 y) { return inst(b, MATH,16, sub_bf16, .x=x.id, .y=y.id); }
+V16 weft_mul_bf16(Builder* b, V16 x, V16 y) {
+    sort_commutative(&x.id, &y.id);
+    return inst(b, MATH,16, mul_bf16, .x=x.id, .y=y.id);
+}
+V16 weft_div_bf16(Builder* b, V16 x, V16 y) { return inst(b, MATH,16, div_bf16, .x=x.id, .y=y.id); }
+
+// r[i] = t[idx[i]], or 0 when idx[i] >= 16, for n a multiple of 8.
+static void tbl16(uint8_t* r, const uint8_t* t, const uint8_t* idx, int n) {
+#if defined(__ARM_NEON)
+    for (int i = 0; i < n; i += 8) { vst1_u8(r+i, vqtbl1_u8(vld1q_u8(t), vld1_u8(idx+i))); }
+#else
+    for (int i = 0; i < n; i++) { r[i] = idx[i] < 16 ? t[idx[i]] : 0; }
+#endif
+}
+
+// Expand a shuffle control for bytes-wide lanes into tbl16() indices for 16 bytes of lanes.
+static void shuffle_indices(uint8_t idx[16], int64_t control, int bytes) {
+    for (int i = 0; i < 16; i++) {
+        const int c = (int)((uint64_t)control >> (8 * (i % bytes)) & 0xff);
+        idx[i] = (uint8_t)(c < bytes ? i / bytes * bytes + c : 0xff);
+    }
+}
+
+// A lookup table is 16 bytes, which conveniently is the size of a V16's N lanes.
+stage(table_16) { int16_t *r=R; memcpy(r, ptr[inst->imm], 16); next(r+N); }
+
+#define SHUFFLE_STAGES(attr, suffix, tbl)                                                         \
+    attr stage(lut16_8##suffix) {                                                                 \
+        uint8_t *r=R, *idx=v(x), *t=v(y);                                                         \
+        tbl(r, t, idx, N);                                                                        \
+        next(r+N);                                                                                \
+    }                                                                                             \
+    attr stage(shuffle_16##suffix) {                                                              \
+        uint8_t *r=R, *x=v(x), idx[16];                                                           \
+        shuffle_indices(idx, inst->imm, 2);                                                       \
+        tbl(r, x, idx, 16);                                                                       \
+        next(r+2*N);                                                                              \
+    }                                                                                             \
+    attr stage(shuffle_32##suffix) {                                                              \
+        uint8_t *r=R, *x=v(x), idx[16];                                                           \
+        shuffle_indices(idx, inst->imm, 4);                                                       \
+        for (int i = 0; i < 4*N; i += 16) { tbl(r+i, x+i, idx, 16); }                             \
+        next(r+4*N);                                                                              \
+    }                                                                                             \
+    attr stage(shuffle_64##suffix) {                                                              \
+        uint8_t *r=R, *x=v(x), idx[16];                                                           \
+        shuffle_indices(idx, inst->imm, 8);                                                       \
+        for (int i = 0; i < 8*N; i += 16) { tbl(r+i, x+i, idx, 16); }                             \
+        next(r+8*N);                                                                              \
+    }
+SHUFFLE_STAGES(,,tbl16)
+
+#if defined(__aarch64__)
+    static char* tbl(char* buf, int Rd, int Rn, int Rm, int Q) {
+        struct {
+            uint32_t Rd  : 5;
+            uint32_t Rn  : 5;
+            uint32_t mid : 6;
+            uint32_t Rm  : 5;
+            uint32_t top : 9;
+            uint32_t Q   : 1;
+            uint32_t z   : 1;
+        } inst = {mask(Rd,5), mask(Rn,5), 0, mask(Rm,5), 0x70, mask(Q,1), 0};
+        return emit(buf, inst);
+    }
+    static char* jit_table_16(char* buf, int d[], int x[], int y[], int z[], int64_t imm) {
+        (void)x; (void)y; (void)z;
+        struct {
+            uint32_t Rt  : 5;
+            uint32_t Rn  : 5;
+            uint32_t top : 22;
+        } ld1_16b = {mask(d[0],5), mask(imm+1,5), 0x13101c};
+        return emit(buf, ld1_16b);
+    }
+    static char* jit_lut16_8(char* buf, int d[], int x[], int y[], int z[], int64_t imm) {
+        (void)z; (void)imm;
+        return tbl(buf, d[0], y[0], x[0], 0);
+    }
+    static char* jit_shuffle(char* buf, int d[], int x[], int64_t control, int bytes) {
+        // Byte swaps are rev16, rev32 or rev64.
+        if (control == (bytes == 2 ? 0x0001 : bytes == 4 ? 0x00010203 : 0x0001020304050607)) {
+            for (int i = 0; i < bytes/2; i++) {
+                buf = simd2(buf, bytes == 4, 0, bytes == 2, d[i], x[i], 1);
+            }
+            return buf;
+        }
+
+        uint8_t idx[16];
+        shuffle_indices(idx, control, bytes);
+        int64_t lo;
+        memcpy(&lo, idx, sizeof lo);
+
+        buf = movz(buf, Rtmp, lo>> 0, 0);
+        buf = movk(buf, Rtmp, lo>>16, 1);
+        buf = movk(buf, Rtmp, lo>>32, 2);
+        buf = movk(buf, Rtmp, lo>>48, 3);
+        for (int i = 0; i < bytes/2; i++) {
+            buf = dup_general(buf, d[i], Rtmp, 8, 1);  // dup.2d d[i], tmp
+            buf = tbl(buf, d[i], x[i], d[i], 1);       // tbl.16b d[i], {x[i]}, d[i]
+        }
+        return buf;
+    }
+    static char* jit_shuffle_16(char* buf, int d[], int x[], int y[], int z[], int64_t imm) {
+        (void)y; (void)z;
+        return jit_shuffle(buf, d,x, imm, 2);
+    }
+    static char* jit_shuffle_32(char* buf, int d[], int x[], int y[], int z[], int64_t imm) {
+        (void)y; (void)z;
+        return jit_shuffle(buf, d,x, imm, 4);
+    }
+    static char* jit_shuffle_64(char* buf, int d[], int x[], int y[], int z[], int64_t imm) {
+        (void)y; (void)z;
+        return jit_shuffle(buf, d,x, imm, 8);
+    }
+#else
+    #define jit_table_16   NULL
+    #define jit_lut16_8    NULL
+    #define jit_shuffle_16 NULL
+    #define jit_shuffle_32 NULL
+    #define jit_shuffle_64 NULL
+#endif
+
+V8 weft_lut16_8(Builder* b, int table_ptr, V8 idx) {
+    V16 table = inst(b, UNIFORM,16, table_16, .imm=use_ptr(b,table_ptr), .jit=jit_table_16);
+    return inst(b, MATH,8, lut16_8, .x=idx.id, .y=table.id, .jit=jit_lut16_8);
+}
+
+// Likewise a 32-byte table fills a V32's N lanes.
+stage(table_32) { int32_t *r=R; memcpy(r, ptr[inst->imm], 32); next(r+N); }
+
+stage(lut32_8) {
+    uint8_t *r=R, *idx=v(x), *t=v(y);
+#if defined(__ARM_NEON)
+    const uint8x16x2_t table = {{vld1q_u8(t), vld1q_u8(t+16)}};
+    vst1_u8(r, vqtbl2_u8(table, vld1_u8(idx)));
+#else
+    each r[i] = idx[i] < 32 ? t[idx[i]] : 0;
+#endif
+    next(r+N);
+}
+
+// The aarch64 JIT would need the table's two halves in consecutive registers for tbl, which its
+// register allocator doesn't promise, so lut32 stays interpreted there.
+V8 weft_lut32_8(Builder* b, int table_ptr, V8 idx) {
+    V32 table = inst(b, UNIFORM,32, table_32, .imm=use_ptr(b,table_ptr));
+    return inst(b, MATH,8, lut32_8, .x=idx.id, .y=table.id);
+}
+
+// Canonicalize shuffle controls so any byte that selects zero reads 0x80,
+// composing shuffles of shuffles into a single shuffle of the original x.
+static int64_t shuffle_control(Builder* b, int* x, uint64_t control, int bytes, Stage* fn) {
+    const BInst inner = b->inst[*x-1];
+    for (int i = 0; i < bytes; i++) {
+        uint64_t c = control >> (8*i) & 0xff;
+        if (c >= (uint64_t)bytes) {
+            c = 0x80;
+        } else if (inner.fn == fn) {
+            c = (uint64_t)inner.imm >> (8*c) & 0xff;
+        }
+        control = (control & ~((uint64_t)0xff << (8*i))) | c << (8*i);
+    }
+    if (inner.fn == fn) {
+        *x = inner.x;
+    }
+    return (int64_t)control;
+}
+V16 weft_shuffle_16(Builder* b, V16 x, uint16_t control) {
+    const int64_t c = shuffle_control(b, &x.id, control, 2, shuffle_16);
+    if (c == 0x0100) { return x; }
+    if (c == 0x8080) { return weft_splat_16(b,0); }
+    return inst(b, MATH,16, shuffle_16, .x=x.id, .imm=c, .jit=jit_shuffle_16);
+}
+V32 weft_shuffle_32(Builder* b, V32 x, uint32_t control) {
+    const int64_t c = shuffle_control(b, &x.id, control, 4, shuffle_32);
+    if (c == 0x03020100) { return x; }
+    if (c == 0x80808080) { return weft_splat_32(b,0); }
+    return inst(b, MATH,32, shuffle_32, .x=x.id, .imm=c, .jit=jit_shuffle_32);
+}
+V64 weft_shuffle_64(Builder* b, V64 x, uint64_t control) {
+    const int64_t c = shuffle_control(b, &x.id, control, 8, shuffle_64);
+    if (c == 0x0706050403020100) { return x; }
+    if (c == (int64_t)0x8080808080808080) { return weft_splat_64(b,0); }
+    return inst(b, MATH,64, shuffle_64, .x=x.id, .imm=c, .jit=jit_shuffle_64);
+}
+
+V16 weft_bswap_16(Builder* b, V16 x) { return weft_shuffle_16(b, x, 0x0001); }
+V32 weft_bswap_32(Builder* b, V32 x) { return weft_shuffle_32(b, x, 0x00010203); }
+V64 weft_bswap_64(Builder* b, V64 x) { return weft_shuffle_64(b, x, 0x0001020304050607); }
+
+// x86 versions of the portable stages above, chosen by best_stage() at weft_compile() time.
+#if defined(__x86_64__) && (defined(__clang__) ? __clang_major__ >= 16 : __GNUC__ >= 12)
+    #define F16C __attribute__((target("avx,f16c")))
+    #define FP16 __attribute__((target("avx512fp16,avx512vl")))
+    #define BF16 __attribute__((target("avx512bf16,avx512vl")))
+    #define SSSE3 __attribute__((target("ssse3")))
+    #define AVX  __attribute__((target("avx")))
+    #define AVX2 __attribute__((target("avx2")))
+    #define VNNI __attribute__((target("avx2,avx512vnni,avx512vl")))
+    #define AVX512   __attribute__((target("avx512f,avx512vl")))
+    #define AVX512CD __attribute__((target("avx512cd,avx512vl")))
+    #define BITALG   __attribute__((target("avx512bitalg,avx512vl")))
+    #define VPOPCNT  __attribute__((target("avx512vpopcntdq,avx512vl")))
+    #define AVX512F  __attribute__((target("avx512f")))
+    #define AVX512BW __attribute__((target("avx512bw,avx512vl")))
+    #define VBMI     __attribute__((target("avx512vbmi,avx512bw,avx512vl")))
+    #define VBMI2    __attribute__((target("avx512vbmi2,avx512bw,avx512vl")))
+
+    // f32 is wide enough that rounding an f32 add, sub, mul, div or sqrt to f16 gives the
+    // correctly rounded f16 result, which is just what AVX-512 FP16 computes directly.
+    static __m256 F16C load_f16c(const __fp16* x) {
+        return _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)x));
+    }
+    static void F16C store_f16c(__fp16* r, __m256 x) {
+        _mm_storeu_si128((__m128i*)r, _mm256_cvtps_ph(x, _MM_FROUND_TO_NEAREST_INT));
+    }
+
+    F16C stage(widen_f16_f16c)  { float  *r=R; __fp16 *x=v(x); _mm256_storeu_ps(r, load_f16c(x));
+                                  next(r+N); }
+    F16C stage(narrow_f32_f16c) { __fp16 *r=R; float  *x=v(x); store_f16c(r, _mm256_loadu_ps(x));
+                                  next(r+N); }
+
+    #define X86_F16_STAGES(name, f16c, fp16)                                                     \
+        F16C stage(name##_f16_f16c) {                                                            \
+            __fp16 *r=R, *x=v(x), *y=v(y); (void)y;                                              \
+            store_f16c(r, f16c);                                                                 \
+            next(r+N);                                                                           \
+        }                                                                                        \
+        FP16 stage(name##_f16_fp16) {                                                            \
+            __fp16 *r=R, *x=v(x), *y=v(y); (void)y;                                              \
+            _mm_storeu_ph(r, fp16);                                                              \
+            next(r+N);                                                                           \
+        }
+    X86_F16_STAGES( add, _mm256_add_ps(load_f16c(x), load_f16c(y)), _mm_add_ph(_mm_loadu_ph(x),
+                                                                               _mm_loadu_ph(y)))
+    X86_F16_STAGES( sub, _mm256_sub_ps(load_f16c(x), load_f16c(y)), _mm_sub_ph(_mm_loadu_ph(x),
+                                                                               _mm_loadu_ph(y)))
+    X86_F16_STAGES( mul, _mm256_mul_ps(load_f16c(x), load_f16c(y)), _mm_mul_ph(_mm_loadu_ph(x),
+                                                                               _mm_loadu_ph(y)))
+    X86_F16_STAGES( div, _mm256_div_ps(load_f16c(x), load_f16c(y)), _mm_div_ph(_mm_loadu_ph(x),
+                                                                               _mm_loadu_ph(y)))
+    X86_F16_STAGES(sqrt, _mm256_sqrt_ps(load_f16c(x))             , _mm_sqrt_ph(_mm_loadu_ph(x)))
+
+    // bf16_from_f32() rounds like vcvtneps2bf16, so only NaN payloads may differ.
+    static __m256 BF16 load_bf16(const uint16_t* x) {
+        __m256i const wide = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)x));
+        return _mm256_castsi256_ps(_mm256_slli_epi32(wide, 16));
+    }
+    static void BF16 store_bf16(uint16_t* r, __m256 x) {
+        __m128bh const narrow = _mm256_cvtneps_pbh(x);
+        memcpy(r, &narrow, sizeof narrow);
+    }
+
+    BF16 stage(narrow_bf16_avx512) {
+        uint16_t *r=R; float *x=v(x);
+        store_bf16(r, _mm256_loadu_ps(x));
+        next(r+N);
+    }
+
+    #define X86_BF16_STAGES(name, op)                                                            \
+        BF16 stage(name##_bf16_avx512) {                                                         \
+            uint16_t *r=R, *x=v(x), *y=v(y);                                                     \
+            store_bf16(r, op(load_bf16(x), load_bf16(y)));                                       \
+            next(r+N);                                                                           \
+        }
+    X86_BF16_STAGES(add, _mm256_add_ps)
+    X86_BF16_STAGES(sub, _mm256_sub_ps)
+    X86_BF16_STAGES(mul, _mm256_mul_ps)
+    X86_BF16_STAGES(div, _mm256_div_ps)
+
+    // Saturating-adding 0x70 sets the high bit of any idx >= 16, which pshufb maps to zero.
+    static void SSSE3 tbl16_ssse3(uint8_t* r, const uint8_t* t, const uint8_t* idx, int n) {
+        __m128i const table = _mm_loadu_si128((const __m128i*)t);
+        for (int i = 0; i < n; i += 8) {
+            __m128i const ix = _mm_adds_epu8(_mm_loadl_epi64((const __m128i*)(idx+i)),
+                                             _mm_set1_epi8(0x70));
+            _mm_storel_epi64((__m128i*)(r+i), _mm_shuffle_epi8(table, ix));
+        }
+    }
+    SHUFFLE_STAGES(SSSE3, _ssse3, tbl16_ssse3)
+
+    // One pshufb per half of the table, each biased so indices outside that half read 0.
+    SSSE3 stage(lut32_8_ssse3) {
+        uint8_t *r=R, *idx=v(x), *t=v(y);
+        __m128i const ix   = _mm_loadl_epi64((const __m128i*)idx),
+                      bias = _mm_set1_epi8(0x70),
+                      lo   = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) t    ),
+                                              _mm_adds_epu8(ix, bias)),
+                      hi   = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(t+16)),
+                                              _mm_adds_epu8(_mm_sub_epi8(ix, _mm_set1_epi8(16)),
+                                                            bias));
+        _mm_storel_epi64((__m128i*)r, _mm_or_si128(lo,hi));
+        next(r+N);
+    }
+    VBMI stage(lut32_8_avx512) {
+        uint8_t *r=R, *idx=v(x), *t=v(y);
+        __m256i const ix = _mm256_zextsi128_si256(_mm_loadl_epi64((const __m128i*)idx));
+        __mmask32 const in = _mm256_cmplt_epu8_mask(ix, _mm256_set1_epi8(32));
+        _mm_storel_epi64((__m128i*)r, _mm256_castsi256_si128(
+                    _mm256_maskz_permutexvar_epi8(in, ix, _mm256_loadu_si256((const __m256i*)t))));
+        next(r+N);
+    }
+
+    // Round to nearest even, as rint() does in the default rounding mode.
+    AVX stage(round_f32_avx) {
+        float *r=R, *x=v(x);
+        _mm256_storeu_ps(r, _mm256_round_ps(_mm256_loadu_ps(x), _MM_FROUND_TO_NEAREST_INT
+                                                              | _MM_FROUND_NO_EXC));
+        next(r+N);
+    }
+    AVX stage(round_f64_avx) {
+        double *r=R, *x=v(x);
+        for (int i = 0; i < N; i += 4) {
+            __m256d const X = _mm256_loadu_pd(x+i);
+            _mm256_storeu_pd(r+i, _mm256_round_pd(X, _MM_FROUND_TO_NEAREST_INT
+                                                   | _MM_FROUND_NO_EXC));
+        }
+        next(r+N);
+    }
+
+    // cvtps2dq produces 0x80000000 for NaN and out-of-range x; flip it to 0x7fffffff for large
+    // positive x and mask NaN to 0 to saturate like sat_32().
+    static __m256i AVX sat_32_avx(__m256 x, __m256i cvt) {
+        __m256 const big = _mm256_cmp_ps(x, _mm256_set1_ps(0x1p31f), _CMP_GE_OQ),
+                     ord = _mm256_cmp_ps(x, x, _CMP_ORD_Q);
+        return _mm256_castps_si256(_mm256_and_ps(ord, _mm256_xor_ps(big,
+                                                                    _mm256_castsi256_ps(cvt))));
+    }
+    AVX stage(cvt_nearest_f32_avx) {
+        int32_t *r=R; float *x=v(x);
+        __m256 const X = _mm256_loadu_ps(x);
+        _mm256_storeu_si256((__m256i*)r, sat_32_avx(X, _mm256_cvtps_epi32(X)));
+        next(r+N);
+    }
+    AVX stage(cvt_trunc_f32_avx) {
+        int32_t *r=R; float *x=v(x);
+        __m256 const X = _mm256_loadu_ps(x);
+        _mm256_storeu_si256((__m256i*)r, sat_32_avx(X, _mm256_cvttps_epi32(X)));
+        next(r+N);
+    }
+
+    // Bit counts and rotates.
+    BITALG stage(popcnt_8_avx512) {
+        uint8_t *r=R, *x=v(x);
+        _mm_storel_epi64((__m128i*)r, _mm_popcnt_epi8(_mm_loadl_epi64((const __m128i*)x)));
+        next(r+N);
+    }
+    BITALG stage(popcnt_16_avx512) {
+        uint16_t *r=R, *x=v(x);
+        _mm_storeu_si128((__m128i*)r, _mm_popcnt_epi16(_mm_loadu_si128((const __m128i*)x)));
+        next(r+N);
+    }
+
+    // ctz(x) is the width of the mask of x's trailing zeros, ~x & (x-1).
+    #define X86_BIT_STAGES(B,set1)                                                               \
+        VPOPCNT stage(popcnt_##B##_avx512) {                                                     \
+            uint##B##_t *r=R, *x=v(x);                                                           \
+            for (int i = 0; i < N; i += 256/B) {                                                 \
+                __m256i const X = _mm256_loadu_si256((const __m256i*)(x+i));                     \
+                _mm256_storeu_si256((__m256i*)(r+i), _mm256_popcnt_epi##B(X));                   \
+            }                                                                                    \
+            next(r+N);                                                                           \
+        }                                                                                        \
+        AVX512CD stage(clz_##B##_avx512) {                                                       \
+            uint##B##_t *r=R, *x=v(x);                                                           \
+            for (int i = 0; i < N; i += 256/B) {                                                 \
+                __m256i const X = _mm256_loadu_si256((const __m256i*)(x+i));                     \
+                _mm256_storeu_si256((__m256i*)(r+i), _mm256_lzcnt_epi##B(X));                    \
+            }                                                                                    \
+            next(r+N);                                                                           \
+        }                                                                                        \
+        AVX512CD stage(ctz_##B##_avx512) {                                                       \
+            uint##B##_t *r=R, *x=v(x);                                                           \
+            for (int i = 0; i < N; i += 256/B) {                                                 \
+                __m256i const X = _mm256_loadu_si256((const __m256i*)(x+i)),                     \
+                              T = _mm256_andnot_si256(X, _mm256_add_epi##B(X, set1(-1))),        \
+                              Z = _mm256_sub_epi##B(set1(B), _mm256_lzcnt_epi##B(T));            \
+                _mm256_storeu_si256((__m256i*)(r+i), Z);                                         \
+            }                                                                                    \
+            next(r+N);                                                                           \
+        }                                                                                        \
+        AVX512 stage(rotli_##B##_avx512) {                                                       \
+            uint##B##_t *r=R, *x=v(x);                                                           \
+            __m256i const n = set1((int)inst->imm);                                              \
+            for (int i = 0; i < N; i += 256/B) {                                                 \
+                __m256i const X = _mm256_loadu_si256((const __m256i*)(x+i));                     \
+                _mm256_storeu_si256((__m256i*)(r+i), _mm256_rolv_epi##B(X, n));                  \
+            }                                                                                    \
+            next(r+N);                                                                           \
+        }                                                                                        \
+        AVX512 stage(rotlv_##B##_avx512) {                                                       \
+            uint##B##_t *r=R, *x=v(x), *y=v(y);                                                  \
+            for (int i = 0; i < N; i += 256/B) {                                                 \
+                __m256i const X = _mm256_loadu_si256((const __m256i*)(x+i)),                     \
+                              Y = _mm256_loadu_si256((const __m256i*)(y+i));                     \
+                _mm256_storeu_si256((__m256i*)(r+i), _mm256_rolv_epi##B(X, Y));                  \
+            }                                                                                    \
+            next(r+N);                                                                           \
+        }                                                                                        \
+        AVX512 stage(rotrv_##B##_avx512) {                                                       \
+            uint##B##_t *r=R, *x=v(x), *y=v(y);                                                  \
+            for (int i = 0; i < N; i += 256/B) {                                                 \
+                __m256i const X = _mm256_loadu_si256((const __m256i*)(x+i)),                     \
+                              Y = _mm256_loadu_si256((const __m256i*)(y+i));                     \
+                _mm256_storeu_si256((__m256i*)(r+i), _mm256_rorv_epi##B(X, Y));                  \
+            }                                                                                    \
+            next(r+N);                                                                           \
+        }
+    X86_BIT_STAGES(32, _mm256_set1_epi32)
+    X86_BIT_STAGES(64, _mm256_set1_epi64x)
+
+    // Masked stores never touch unselected lanes' memory, so they're safe past the tail too.
+    #define X86_STORE_MASKED_BW(B, M, load, test, store)                                         \
+        AVX512BW stage(store_masked_##B##_avx512) {                                              \
+            const void *mask=v(x), *x=v(y);                                                      \
+            unsigned k = test(load(mask), load(mask));                                           \
+            k &= tail ? (1u << tail) - 1 : 0xff;                                                 \
+            store((uint##B##_t*)ptr[inst->imm] + off, (M)k, load(x));                            \
+            next(R);                                                                             \
+        }
+    X86_STORE_MASKED_BW( 8, __mmask16, _mm_loadl_epi64, _mm_test_epi8_mask , _mm_mask_storeu_epi8 )
+    X86_STORE_MASKED_BW(16, __mmask8 , _mm_loadu_si128, _mm_test_epi16_mask, _mm_mask_storeu_epi16)
+
+    // vpmaskmov stores lanes whose top bit is set.
+    static __m256i AVX2 maskmov_mask(__m256i m, __m256i lane, unsigned tail) {
+        __m256i const live = tail ? _mm256_cmpgt_epi32(_mm256_set1_epi32((int)tail), lane)
+                                  : _mm256_set1_epi32(-1);
+        return _mm256_andnot_si256(m, live);
+    }
+    AVX2 stage(store_masked_32_avx2) {
+        int32_t *mask=v(x), *x=v(y);
+        __m256i const M = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*)mask),
+                                             _mm256_setzero_si256());
+        _mm256_maskstore_epi32((int*)ptr[inst->imm] + off,
+                               maskmov_mask(M, _mm256_setr_epi32(0,1,2,3,4,5,6,7), tail),
+                               _mm256_loadu_si256((const __m256i*)x));
+        next(R);
+    }
+    AVX2 stage(store_masked_64_avx2) {
+        int64_t *mask=v(x), *x=v(y);
+        for (int i = 0; i < N; i += 4) {
+            __m256i const M = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)(mask+i)),
+                                                 _mm256_setzero_si256());
+            // Each 64-bit lane's index, duplicated into both its 32-bit halves.
+            __m256i const lane = _mm256_setr_epi32(i+0,i+0, i+1,i+1, i+2,i+2, i+3,i+3);
+            _mm256_maskstore_epi64((long long*)ptr[inst->imm] + off + i,
+                                   maskmov_mask(M, lane, tail),
+                                   _mm256_loadu_si256((const __m256i*)(x+i)));
+        }
+        next(R);
+    }
+
+    // pshufb indices moving the lanes set in k to the front of 16 bytes of bytes-wide lanes.
+    static __m128i SSSE3 compress_shuffle_ssse3(unsigned k, int bytes) {
+        __m128i idx = _mm_loadl_epi64((const __m128i*)(compress_lanes + k));
+        for (int b = 1; b < bytes; b *= 2) {
+            idx = _mm_unpacklo_epi8(idx, idx);
+            idx = _mm_add_epi8(idx, idx);
+        }
+        return _mm_or_si128(idx, _mm_and_si128(_mm_setr_epi8(0,1,2,3,4,5,6,7,
+                                                             8,9,10,11,12,13,14,15),
+                                               _mm_set1_epi8((char)(bytes-1))));
+    }
+
+    // Like compress(), one pshufb per 16 bytes of lanes.
+    static int SSSE3 compress_ssse3(char* r, const char* x, unsigned k, int bytes) {
+        if (bytes == 1) {
+            _mm_storel_epi64((__m128i*)r, _mm_shuffle_epi8(_mm_loadl_epi64((const __m128i*)x),
+                                                           compress_shuffle_ssse3(k, 1)));
+            return __builtin_popcount(k);
+        }
+        const int lanes = 16 / bytes;
+        int n = 0;
+        for (int i = 0; i < N; i += lanes) {
+            const unsigned part = k >> i & ((1u << lanes) - 1);
+            _mm_storeu_si128((__m128i*)(r + n),
+                             _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(x + i*bytes)),
+                                              compress_shuffle_ssse3(part, bytes)));
+            n += __builtin_popcount(part) * bytes;
+        }
+        return n;
+    }
+    #define X86_STORE_COMPRESS_SSSE3(B)                                                          \
+        SSSE3 stage(store_compress_##B##_ssse3) {                                                \
+            char tmp[N*B/8 + 16];                                                                \
+            const unsigned k = compress_mask_##B(v(x), tail);                                    \
+            store_compressed(inst, ptr, tmp, compress_ssse3(tmp, v(y), k, B/8), B/8);            \
+            (void)off;                                                                           \
+            next(R);                                                                             \
+        }
+    X86_STORE_COMPRESS_SSSE3( 8)
+    X86_STORE_COMPRESS_SSSE3(16)
+    X86_STORE_COMPRESS_SSSE3(32)
+    X86_STORE_COMPRESS_SSSE3(64)
+
+    // vpcompress packs the selected lanes to the bottom, and a masked store writes just those.
+    #define X86_STORE_COMPRESS(B, attr, M, load, test, compress, store)                          \
+        attr stage(store_compress_##B##_avx512) {                                                \
+            const void *mask=v(x), *x=v(y);                                                      \
+            unsigned k = test(load(mask), load(mask));                                           \
+            k &= tail ? (1u << tail) - 1 : 0xff;                                                 \
+            const int n = __builtin_popcount(k);                                                 \
+            int64_t* count = ptr[inst->imm >> 32];                                               \
+            store((uint##B##_t*)ptr[(uint32_t)inst->imm] + *count, (M)((1u << n) - 1),           \
+                  compress((M)k, load(x)));                                                      \
+            *count += n;                                                                         \
+            (void)off;                                                                           \
+            next(R);                                                                             \
+        }
+    X86_STORE_COMPRESS( 8, VBMI2  , __mmask16, _mm_loadl_epi64, _mm_test_epi8_mask,
+                        _mm_maskz_compress_epi8, _mm_mask_storeu_epi8)
+    X86_STORE_COMPRESS(16, VBMI2  , __mmask8 , _mm_loadu_si128, _mm_test_epi16_mask,
+                        _mm_maskz_compress_epi16, _mm_mask_storeu_epi16)
+    X86_STORE_COMPRESS(32, AVX512 , __mmask8 , _mm256_loadu_si256, _mm256_test_epi32_mask,
+                        _mm256_maskz_compress_epi32, _mm256_mask_storeu_epi32)
+    X86_STORE_COMPRESS(64, AVX512F, __mmask8 , _mm512_loadu_si512, _mm512_test_epi64_mask,
+                        _mm512_maskz_compress_epi64, _mm512_mask_storeu_epi64)
+
+    // Without conflicts each bucket appears at most once, so a gather, add and scatter will do.
+    // Buckets past 2^31 would look negative to vpgatherdd, so they take the portable path too.
+    AVX512CD stage(histogram_add_32_avx512) {
+        uint32_t *bucket=v(x), *weight=v(y);
+        uint32_t* count = histogram_counts(inst,V,bucket,tail,ptr);
+        __mmask8 const live = tail ? (__mmask8)((1u << tail) - 1) : 0xff;
+        __m256i  const B    = _mm256_loadu_si256((const __m256i*)bucket),
+                       W    = _mm256_loadu_si256((const __m256i*)weight);
+        if (_mm256_mask_test_epi32_mask(live, _mm256_conflict_epi32(B), _mm256_set1_epi32(live))
+                || (_mm256_movemask_ps(_mm256_castsi256_ps(B)) & live)) {
+            for (int i = 0; i < (tail ? (int)tail : N); i++) {
+                count[bucket[i]] += weight[i];
+            }
+        } else {
+            __m256i const C = _mm256_mmask_i32gather_epi32(_mm256_setzero_si256(), live, B,
+                                                           count, 4);
+            _mm256_mask_i32scatter_epi32(count, live, B, _mm256_add_epi32(C,W), 4);
+        }
+        (void)off;
+        next(R);
+    }
+
+    // Gathers need each lane's byte offset to fit in 32 bits, and can't skip lanes past a tail.
+    AVX2 stage(load_strided_32_avx2) {
+        const int64_t stride = inst->imm >> 32;
+        if (tail || stride > INT32_MAX / N || stride < INT32_MIN / N) {
+            load_strided_(inst,off,tail,R,ptr, 4);
+        } else {
+            const int* src = (const int*)((const char*)ptr[(uint32_t)inst->imm] + off * stride);
+            const __m256i ix = _mm256_mullo_epi32(_mm256_setr_epi32(0,1,2,3,4,5,6,7),
+                                                  _mm256_set1_epi32((int)stride));
+            _mm256_storeu_si256((__m256i*)R, _mm256_i32gather_epi32(src, ix, 1));
+        }
+        next((int32_t*)R+N);
+    }
+    AVX2 stage(load_strided_64_avx2) {
+        const int64_t stride = inst->imm >> 32;
+        if (tail) {
+            load_strided_(inst,off,tail,R,ptr, 8);
+        } else {
+            const long long* src = (const long long*)((const char*)ptr[(uint32_t)inst->imm]
+                                                      + off * stride);
+            for (int i = 0; i < N; i += 4) {
+                const __m256i ix = _mm256_setr_epi64x((i+0) * stride, (i+1) * stride,
+                                                      (i+2) * stride, (i+3) * stride);
+                _mm256_storeu_si256((__m256i*)R + i/4, _mm256_i64gather_epi64(src, ix, 1));
+            }
+        }
+        next((int64_t*)R+N);
+    }
+
+    // Log-step scans within each 128-bit half, then carry the low half's total into the high.
+    AVX2 stage(scan_add_32_avx2) {
+        uint32_t *r=R, *x=v(x);
+        uint64_t* carry = (uint64_t*)((char*)V + (uint32_t)inst->imm);
+        __m256i X = _mm256_loadu_si256((const __m256i*)x);
+        X = _mm256_add_epi32(X, _mm256_slli_si256(X, 4));
+        X = _mm256_add_epi32(X, _mm256_slli_si256(X, 8));
+        X = _mm256_add_epi32(X, _mm256_shuffle_epi32(_mm256_permute2x128_si256(X,X, 0x08), 0xff));
+        X = _mm256_add_epi32(X, _mm256_set1_epi32((int)*carry));
+        _mm256_storeu_si256((__m256i*)r, X);
+        *carry = r[tail ? tail-1 : N-1];
+        next(r+N);
+    }
+    AVX2 stage(scan_add_64_avx2) {
+        uint64_t *r=R, *x=v(x);
+        uint64_t* carry = (uint64_t*)((char*)V + (uint32_t)inst->imm);
+        __m256i C = _mm256_set1_epi64x((long long)*carry);
+        for (int i = 0; i < N; i += 4) {
+            __m256i X = _mm256_loadu_si256((const __m256i*)(x+i));
+            X = _mm256_add_epi64(X, _mm256_slli_si256(X, 8));
+            X = _mm256_add_epi64(X, _mm256_shuffle_epi32(_mm256_permute2x128_si256(X,X, 0x08),
+                                                         0xee));
+            X = _mm256_add_epi64(X, C);
+            _mm256_storeu_si256((__m256i*)(r+i), X);
+            C = _mm256_permute4x64_epi64(X, 0xff);
+        }
+        *carry = r[tail ? tail-1 : N-1];
+        next(r+N);
+    }
+
+    // pmaddubsw would saturate u8*s8 pair sums, so without VNNI dot_u8s8 splits even and odd
+    // bytes into 16-bit halves and uses pmaddwd on each.
+    AVX2 stage(dot_s16_avx2) {
+        int32_t *r=R, *x=v(x), *y=v(y), *z=v(z);
+        __m256i const X = _mm256_loadu_si256((const __m256i*)x),
+                      Y = _mm256_loadu_si256((const __m256i*)y),
+                      Z = _mm256_loadu_si256((const __m256i*)z);
+        _mm256_storeu_si256((__m256i*)r, _mm256_add_epi32(Z, _mm256_madd_epi16(X,Y)));
+        next(r+N);
+    }
+    AVX2 stage(dot_u8s8_avx2) {
+        int32_t *r=R, *x=v(x), *y=v(y), *z=v(z);
+        __m256i const X = _mm256_loadu_si256((const __m256i*)x),
+                      Y = _mm256_loadu_si256((const __m256i*)y),
+                      Z = _mm256_loadu_si256((const __m256i*)z),
+                 even = _mm256_madd_epi16(_mm256_and_si256(X, _mm256_set1_epi16(0xff)),
+                                          _mm256_srai_epi16(_mm256_slli_epi16(Y,8),8)),
+                  odd = _mm256_madd_epi16(_mm256_srli_epi16(X,8), _mm256_srai_epi16(Y,8));
+        _mm256_storeu_si256((__m256i*)r, _mm256_add_epi32(Z, _mm256_add_epi32(even,odd)));
+        next(r+N);
+    }
+    VNNI stage(dot_s16_vnni) {
+        int32_t *r=R, *x=v(x), *y=v(y), *z=v(z);
+        _mm256_storeu_si256((__m256i*)r,
+                            _mm256_dpwssd_epi32(_mm256_loadu_si256((const __m256i*)z),
+                                                _mm256_loadu_si256((const __m256i*)x),
+                                                _mm256_loadu_si256((const __m256i*)y)));
+        next(r+N);
+    }
+    VNNI stage(dot_u8s8_vnni) {
+        int32_t *r=R, *x=v(x), *y=v(y), *z=v(z);
+        _mm256_storeu_si256((__m256i*)r,
+                            _mm256_dpbusd_epi32(_mm256_loadu_si256((const __m256i*)z),
+                                                _mm256_loadu_si256((const __m256i*)x),
+                                                _mm256_loadu_si256((const __m256i*)y)));
+        next(r+N);
+    }
+
+    // movntdq needs 16-byte alignment and movnti 8; anything else takes the usual path.
+    static void store_nontemporal(char* dst, const char* src, size_t len) {
+        if (((uintptr_t)dst & 15) == 0) {
+            for (; len >= 16; len -= 16, dst += 16, src += 16) {
+                _mm_stream_si128((__m128i*)dst, _mm_loadu_si128((const __m128i*)src));
+            }
+        }
+        if (((uintptr_t)dst & 7) == 0) {
+            for (; len >= 8; len -= 8, dst += 8, src += 8) {
+                long long x;
+                memcpy(&x, src, sizeof x);
+                _mm_stream_si64((long long*)dst, x);
+            }
+        }
+        memcpy(dst, src, len);
+    }
+    #define STORE_NONTEMPORAL(B)                                                                \
+        stage(store_##B##_nontemporal) {                                                        \
+            store_nontemporal((char*)ptr[inst->imm] + B/8*off, v(x), B/8*(tail ? tail : N));    \
+            next(R);                                                                            \
+        }                                                                                       \
+        stage(store_##B##_done_nontemporal) {                                                   \
+            store_nontemporal((char*)ptr[inst->imm] + B/8*off, v(x), B/8*(tail ? tail : N));    \
+            (void)R;                                                                            \
+        }
+    STORE_NONTEMPORAL( 8)
+    STORE_NONTEMPORAL(16)
+    STORE_NONTEMPORAL(32)
+    STORE_NONTEMPORAL(64)
+
+    static const struct { Stage *temporal, *nontemporal; const char* name; } nontemporal[] = {
+    #define NONTEMPORAL(fn) {fn, fn##_nontemporal, #fn "_nontemporal"},
+        NONTEMPORAL(store_8 ) NONTEMPORAL(store_8_done )
+        NONTEMPORAL(store_16) NONTEMPORAL(store_16_done)
+        NONTEMPORAL(store_32) NONTEMPORAL(store_32_done)
+        NONTEMPORAL(store_64) NONTEMPORAL(store_64_done)
+    #undef NONTEMPORAL
+    };
+    static Stage* nontemporal_stage(Stage* fn) {
+        for (int i = 0; i < (int)(sizeof nontemporal / sizeof *nontemporal); i++) {
+            if (fn == nontemporal[i].temporal) {
+                return nontemporal[i].nontemporal;
+            }
+        }
+        return NULL;
+    }
+    static void nontemporal_fence(void) { _mm_sfence(); }
+
+    enum {
+        CPU_SSSE3  = 1<< 1, CPU_AVX      = 1<< 2, CPU_AVX2   = 1<< 3, CPU_VNNI    = 1<< 4,
+        CPU_AVX512 = 1<< 5, CPU_AVX512CD = 1<< 6, CPU_BITALG = 1<< 7, CPU_VPOPCNT = 1<< 8,
+        CPU_VBMI2  = 1<< 9, CPU_AVX512BW = 1<<10, CPU_F16C   = 1<<11, CPU_FP16    = 1<<12,
+        CPU_BF16   = 1<<13, CPU_VBMI     = 1<<14,
+    };
+
+    // The CPU_* features this machine supports, queried once.  Bit 0 marks the cache as filled.
+    static int cpu_features(void) {
+        static int cached;
+        int cpu = __atomic_load_n(&cached, __ATOMIC_RELAXED);
+        if (!cpu) {
+            const bool avx512 = __builtin_cpu_supports("avx512vl");
+            cpu = 1
+                | (__builtin_cpu_supports("ssse3")                     ? CPU_SSSE3    : 0)
+                | (__builtin_cpu_supports("avx")                       ? CPU_AVX      : 0)
+                | (__builtin_cpu_supports("avx2")                      ? CPU_AVX2     : 0)
+                | (__builtin_cpu_supports("avx512vnni")                ? CPU_VNNI     : 0)
+                | (avx512                                              ? CPU_AVX512   : 0)
+                | (__builtin_cpu_supports("avx512cd")        && avx512 ? CPU_AVX512CD : 0)
+                | (__builtin_cpu_supports("avx512bitalg")              ? CPU_BITALG   : 0)
+                | (__builtin_cpu_supports("avx512vpopcntdq") && avx512 ? CPU_VPOPCNT  : 0)
+                | (__builtin_cpu_supports("avx512vbmi")      && avx512 ? CPU_VBMI     : 0)
+                | (__builtin_cpu_supports("avx512vbmi2")     && avx512 ? CPU_VBMI2    : 0)
+                | (__builtin_cpu_supports("avx512bw")        && avx512 ? CPU_AVX512BW : 0)
+                | (__builtin_cpu_supports("f16c")                      ? CPU_F16C     : 0)
+                | (__builtin_cpu_supports("avx512fp16")                ? CPU_FP16     : 0)
+                | (__builtin_cpu_supports("avx512bf16")                ? CPU_BF16     : 0);
+            __atomic_store_n(&cached, cpu, __ATOMIC_RELAXED);
+        }
+        return cpu;
+    }
+
+    // In order of preference when a stage has more than one variant, with rough costs like ops[].
+    static const struct { Stage *portable, *fast; const char* name; int cpu, cost; } variants[] = {
+    #define VARIANT(portable, fast, cpu, cost) {portable, fast, #fast, cpu, cost},
+        VARIANT(   add_f16,    add_f16_fp16, CPU_FP16, 1)
+        VARIANT(   sub_f16,    sub_f16_fp16, CPU_FP16, 1)
+        VARIANT(   mul_f16,    mul_f16_fp16, CPU_FP16, 1)
+        VARIANT(   div_f16,    div_f16_fp16, CPU_FP16, 4)
+        VARIANT(  sqrt_f16,   sqrt_f16_fp16, CPU_FP16, 4)
+
+        VARIANT( widen_f16,  widen_f16_f16c, CPU_F16C, 1)
+        VARIANT(narrow_f32, narrow_f32_f16c, CPU_F16C, 1)
+        VARIANT(   add_f16,    add_f16_f16c, CPU_F16C, 2)
+        VARIANT(   sub_f16,    sub_f16_f16c, CPU_F16C, 2)
+        VARIANT(   mul_f16,    mul_f16_f16c, CPU_F16C, 2)
+        VARIANT(   div_f16,    div_f16_f16c, CPU_F16C, 8)
+        VARIANT(  sqrt_f16,   sqrt_f16_f16c, CPU_F16C, 8)
+
+        VARIANT(narrow_bf16, narrow_bf16_avx512, CPU_BF16, 1)
+        VARIANT(   add_bf16,    add_bf16_avx512, CPU_BF16, 2)
+        VARIANT(   sub_bf16,    sub_bf16_avx512, CPU_BF16, 2)
+        VARIANT(   mul_bf16,    mul_bf16_avx512, CPU_BF16, 2)
+        VARIANT(   div_bf16,    div_bf16_avx512, CPU_BF16, 8)
+
+        VARIANT(   lut16_8,    lut16_8_ssse3, CPU_SSSE3, 1)
+        VARIANT(   lut32_8,   lut32_8_avx512, CPU_VBMI , 1)
+        VARIANT(   lut32_8,    lut32_8_ssse3, CPU_SSSE3, 2)
+        VARIANT(shuffle_16, shuffle_16_ssse3, CPU_SSSE3, 1)
+        VARIANT(shuffle_32, shuffle_32_ssse3, CPU_SSSE3, 1)
+        VARIANT(shuffle_64, shuffle_64_ssse3, CPU_SSSE3, 1)
+
+        VARIANT(      round_f32,       round_f32_avx, CPU_AVX, 1)
+        VARIANT(      round_f64,       round_f64_avx, CPU_AVX, 1)
+        VARIANT(cvt_nearest_f32, cvt_nearest_f32_avx, CPU_AVX, 1)
+        VARIANT(  cvt_trunc_f32,   cvt_trunc_f32_avx, CPU_AVX, 1)
+
+        VARIANT(popcnt_8 , popcnt_8_avx512 , CPU_BITALG, 1)
+        VARIANT(popcnt_16, popcnt_16_avx512, CPU_BITALG, 1)
+        VARIANT(popcnt_32, popcnt_32_avx512, CPU_VPOPCNT, 1)
+        VARIANT(popcnt_64, popcnt_64_avx512, CPU_VPOPCNT, 1)
+        VARIANT(   clz_32,    clz_32_avx512, CPU_AVX512CD, 1)
+        VARIANT(   clz_64,    clz_64_avx512, CPU_AVX512CD, 1)
+        VARIANT(   ctz_32,    ctz_32_avx512, CPU_AVX512CD, 1)
+        VARIANT(   ctz_64,    ctz_64_avx512, CPU_AVX512CD, 1)
+        VARIANT( rotli_32,  rotli_32_avx512, CPU_AVX512, 1)
+        VARIANT( rotli_64,  rotli_64_avx512, CPU_AVX512, 1)
+        VARIANT( rotlv_32,  rotlv_32_avx512, CPU_AVX512, 1)
+        VARIANT( rotlv_64,  rotlv_64_avx512, CPU_AVX512, 1)
+        VARIANT( rotrv_32,  rotrv_32_avx512, CPU_AVX512, 1)
+        VARIANT( rotrv_64,  rotrv_64_avx512, CPU_AVX512, 1)
+
+        VARIANT(store_masked_8 , store_masked_8_avx512 , CPU_AVX512BW, 1)
+        VARIANT(store_masked_16, store_masked_16_avx512, CPU_AVX512BW, 1)
+        VARIANT(store_masked_32, store_masked_32_avx2  , CPU_AVX2, 1)
+        VARIANT(store_masked_64, store_masked_64_avx2  , CPU_AVX2, 1)
+
+        VARIANT(store_compress_8 , store_compress_8_avx512 , CPU_VBMI2, 2)
+        VARIANT(store_compress_16, store_compress_16_avx512, CPU_VBMI2, 2)
+        VARIANT(store_compress_32, store_compress_32_avx512, CPU_AVX512, 2)
+        VARIANT(store_compress_64, store_compress_64_avx512, CPU_AVX512, 2)
+        VARIANT(store_compress_8 , store_compress_8_ssse3  , CPU_SSSE3 , 3)
+        VARIANT(store_compress_16, store_compress_16_ssse3 , CPU_SSSE3 , 3)
+        VARIANT(store_compress_32, store_compress_32_ssse3 , CPU_SSSE3 , 3)
+        VARIANT(store_compress_64, store_compress_64_ssse3 , CPU_SSSE3 , 3)
+
+        VARIANT(histogram_add_32, histogram_add_32_avx512, CPU_AVX512CD, 4)
+
+        VARIANT(load_strided_32, load_strided_32_avx2, CPU_AVX2, 4)
+        VARIANT(load_strided_64, load_strided_64_avx2, CPU_AVX2, 4)
+
+        VARIANT(scan_add_32, scan_add_32_avx2, CPU_AVX2, 2)
+        VARIANT(scan_add_64, scan_add_64_avx2, CPU_AVX2, 2)
+
+        VARIANT( dot_s16,  dot_s16_vnni, CPU_VNNI, 1)
+        VARIANT(dot_u8s8, dot_u8s8_vnni, CPU_VNNI, 1)
+        VARIANT( dot_s16,  dot_s16_avx2, CPU_AVX2, 1)
+        VARIANT(dot_u8s8, dot_u8s8_avx2, CPU_AVX2, 1)
+    #undef VARIANT
+    };
+
+    static Stage* best_stage(Stage* fn) {
+        for (int i = 0; i < (int)(sizeof variants / sizeof *variants); i++) {
+            if (fn == variants[i].portable && (cpu_features() & variants[i].cpu)) {
+                return variants[i].fast;
+            }
+        }
+        return fn;
+    }
+
+    // The portable stage that x86 variant or non-temporal store fn stands in for, along with fn's
+    // own name and cost if it has one, or NULL if fn is neither.
+    static Stage* portable_stage(Stage* fn, const char** name, int* cost) {
+        for (int i = 0; i < (int)(sizeof variants / sizeof *variants); i++) {
+            if (fn == variants[i].fast) {
+                *name = variants[i].name;
+                *cost = variants[i].cost;
+                return variants[i].portable;
+            }
+        }
+        for (int i = 0; i < (int)(sizeof nontemporal / sizeof *nontemporal); i++) {
+            if (fn == nontemporal[i].nontemporal) {
+                *name = nontemporal[i].name;
+                return nontemporal[i].temporal;
+            }
+        }
+        return NULL;
+    }
+#else
+    static Stage* best_stage(Stage* fn) { return fn; }
+    static Stage* nontemporal_stage(Stage* fn) { (void)fn; return NULL; }
+    static Stage* portable_stage(Stage* fn, const char** name, int* cost) {
+        (void)fn; (void)name; (void)cost;
+        return NULL;
+    }
+    static void nontemporal_fence(void) {}
+#endif
+
+// weft_emit_c() writes each live inst as one line of C from these templates, with x, y and z
+// standing in for its arguments, imm for its immediate and i for the loop index.  Every value is
+// held as a uintB_t, with F32()/U32() and F64()/U64() bit-casting to and from float and double.
+#define C_INT_TEMPLATES(B,S,U)                                                                  \
+    {not_  ##B, "(" #U ")~x"},                                                                  \
+    {shli_i##B, "(" #U ")(1u * x << imm)"},                                                     \
+    {shri_s##B, "(" #U ")((" #S ")x >> imm)"},                                                  \
+    {shri_u##B, "(" #U ")(x >> imm)"},                                                          \
+    {shlv_i##B, "(" #U ")(1u * x << (" #S ")y)"},                                               \
+    {shrv_s##B, "(" #U ")((" #S ")x >> (" #S ")y)"},                                            \
+    {shrv_u##B, "(" #U ")(x >> y)"},                                                            \
+    {add_i ##B, "(" #U ")(x + y)"},                                                             \
+    {sub_i ##B, "(" #U ")(x - y)"},                                                             \
+    {mul_i ##B, "(" #U ")(1u * x * y)"},                                                        \
+    {and_  ##B, "(" #U ")(x & y)"},                                                             \
+    {bic_  ##B, "(" #U ")(x & ~y)"},                                                            \
+    { or_  ##B, "(" #U ")(x | y)"},                                                             \
+    {xor_  ##B, "(" #U ")(x ^ y)"},                                                             \
+    {sel_  ##B, "(" #U ")((x & y) | (~x & z))"},                                                \
+    {eq_i  ##B, "(" #U ")-(x == y)"},                                                           \
+    {lt_s  ##B, "(" #U ")-((" #S ")x < (" #S ")y)"},                                            \
+    {lt_u  ##B, "(" #U ")-(x < y)"},                                                            \
+    {le_s  ##B, "(" #U ")-((" #S ")x <= (" #S ")y)"},                                           \
+    {le_u  ##B, "(" #U ")-(x <= y)"},                                                           \
+    {min_s ##B, "(" #U ")((" #S ")x < (" #S ")y ? x : y)"},                                     \
+    {min_u ##B, "(" #U ")(x < y ? x : y)"},                                                     \
+    {max_s ##B, "(" #U ")((" #S ")x < (" #S ")y ? y : x)"},                                     \
+    {max_u ##B, "(" #U ")(x < y ? y : x)"},                                                     \
+    {abs_s ##B, "(" #U ")((" #S ")x < 0 ? -x : x)"},                                            \
+    {splat_  ##B, "(" #U ")imm"},                                                               \
+    {uniform_##B, "*(const " #U "*)ptr[imm]"},                                                  \
+    {load_   ##B, "((const " #U "*)ptr[imm])[i]"},                                              \
+    {store_  ##B, "((" #U "*)ptr[imm])[i] = x;"},                                               \
+    {store_masked_##B, "if (x) { ((" #U "*)ptr[imm])[i] = y; }"},                               \
+    {assert_ ##B, "assert(x);"},
+#define C_FLOAT_TEMPLATES(B,S,U)                                                                \
+    {cast_f##B, "(" #U ")(" #S ")F" #B "(x)"},                                                  \
+    {cast_s##B, "U" #B "((f" #B ")(" #S ")x)"},                                                 \
+    {ceil_f##B, "U" #B "(ceil(F" #B "(x)))"},                                                   \
+    {floor_f##B, "U" #B "(floor(F" #B "(x)))"},                                                 \
+    {round_f##B, "U" #B "(rint(F" #B "(x)))"},                                                  \
+    {sqrt_f##B, "U" #B "(sqrt(F" #B "(x)))"},                                                   \
+    {abs_f##B, "U" #B "(fabs(F" #B "(x)))"},                                                    \
+    {add_f##B, "U" #B "(F" #B "(x) + F" #B "(y))"},                                             \
+    {sub_f##B, "U" #B "(F" #B "(x) - F" #B "(y))"},                                             \
+    {mul_f##B, "U" #B "(F" #B "(x) * F" #B "(y))"},                                             \
+    {div_f##B, "U" #B "(F" #B "(x) / F" #B "(y))"},                                             \
+    {min_f##B, "U" #B "(fmin(F" #B "(x), F" #B "(y)))"},                                        \
+    {max_f##B, "U" #B "(fmax(F" #B "(x), F" #B "(y)))"},                                        \
+    {eq_f##B, "(" #U ")-(F" #B "(x) == F" #B "(y))"},                                           \
+    {lt_f##B, "(" #U ")-(F" #B "(x) <  F" #B "(y))"},                                           \
+    {le_f##B, "(" #U ")-(F" #B "(x) <= F" #B "(y))"},
+
+static const struct { Stage* fn; const char* c; } c_templates[] = {
+    C_INT_TEMPLATES( 8, int8_t, uint8_t)
+    C_INT_TEMPLATES(16,int16_t,uint16_t)
+    C_INT_TEMPLATES(32,int32_t,uint32_t)
+    C_INT_TEMPLATES(64,int64_t,uint64_t)
+    C_FLOAT_TEMPLATES(32,int32_t,uint32_t)
+    C_FLOAT_TEMPLATES(64,int64_t,uint64_t)
+
+    {index_32, "(uint32_t)i"},
+    {index_64, "(uint64_t)i"},
+
+    {narrow_i16, "(uint8_t )x"},
+    {narrow_i32, "(uint16_t)x"},
+    {narrow_i64, "(uint32_t)x"},
+    {narrow_f64, "U32((f32)F64(x))"},
+    {widen_s8 , "(uint16_t)(int8_t )x"},
+    {widen_s16, "(uint32_t)(int16_t)x"},
+    {widen_s32, "(uint64_t)(int32_t)x"},
+    {widen_u8 , "(uint16_t)x"},
+    {widen_u16, "(uint32_t)x"},
+    {widen_u32, "(uint64_t)x"},
+    {widen_f32, "U64((f64)F32(x))"},
+};
+
+static const char* c_template(Stage* fn) {
+    for (int i = 0; i < (int)(sizeof c_templates / sizeof *c_templates); i++) {
+        if (fn == c_templates[i].fn) {
+            return c_templates[i].c;
+        }
+    }
+    return NULL;
+}
+
+static void emit_c_inst(FILE* f, const Builder* b, int id, const char* indent) {
+    const BInst inst = b->inst[id-1];
+    if (inst.kind == SIDE_EFFECT) {
+        fprintf(f, "%s", indent);
+    } else {
+        fprintf(f, "%sconst uint%d_t v%d = ", indent, 8*inst.slots, id);
+    }
+    for (const char* c = c_template(inst.fn); *c;) {
+        size_t len = 0;
+        while (c[len] == '_' || ('a' <= c[len] && c[len] <= 'z')
+                             || ('A' <= c[len] && c[len] <= 'Z')
+                             || (len && '0' <= c[len] && c[len] <= '9')) {
+            len++;
+        }
+        if      (len == 1 && *c == 'x') { fprintf(f, "v%d", inst.x); }
+        else if (len == 1 && *c == 'y') { fprintf(f, "v%d", inst.y); }
+        else if (len == 1 && *c == 'z') { fprintf(f, "v%d", inst.z); }
+        else if (len == 3 && 0 == memcmp(c, "imm", 3)) {
+            inst.imm == INT64_MIN ? fprintf(f, "INT64_MIN")
+          : inst.imm < 0          ? fprintf(f, "(%lld)", (long long)inst.imm)
+          :                         fprintf(f,  "%lld" , (long long)inst.imm);
+        }
+        else    { fwrite(c, 1, len ? len : 1, f); }
+        c += len ? len : 1;
+    }
+    fprintf(f, "%s\n", inst.kind == SIDE_EFFECT ? "" : ";");
+}
+
+int weft_emit_c(const Builder* b, const char* name, FILE* f) {
+    struct { bool live, loop_dependent; } *meta = calloc((size_t)b->inst_len + 1, sizeof *meta);
+    int ok = b->region == 0;
+    for (int i = b->inst_len; i --> 0;) {
+        const BInst inst = b->inst[i];
+        meta[i].live |= inst.kind >= SIDE_EFFECT;
+        if (meta[i].live) {
+            ok &= c_template(inst.fn) != NULL;
+            if (inst.x) { meta[inst.x-1].live = true; }
+            if (inst.y) { meta[inst.y-1].live = true; }
+            if (inst.z) { meta[inst.z-1].live = true; }
+        }
+    }
+    for (int i = 0; i < b->inst_len; i++) {
+        const BInst inst = b->inst[i];
+        meta[i].loop_dependent = inst.kind >= LOAD
+                              || (inst.x && meta[inst.x-1].loop_dependent)
+                              || (inst.y && meta[inst.y-1].loop_dependent)
+                              || (inst.z && meta[inst.z-1].loop_dependent);
+    }
+
+    if (ok) {
+        fprintf(f, "#if !defined(WEFT_EMIT_C_PRELUDE)\n"
+                   "#define WEFT_EMIT_C_PRELUDE\n"
+                   "#include <assert.h>\n"
+                   "#include <stdint.h>\n"
+                   "#include <string.h>\n"
+                   "#include <tgmath.h>\n"
+                   "typedef float  f32;\n"
+                   "typedef double f64;\n"
+                   "static inline f32 F32(uint32_t x) { f32 r; memcpy(&r,&x,4); return r; }\n"
+                   "static inline f64 F64(uint64_t x) { f64 r; memcpy(&r,&x,8); return r; }\n"
+                   "static inline uint32_t U32(f32 x) { uint32_t r; memcpy(&r,&x,4); return r; }\n"
+                   "static inline uint64_t U64(f64 x) { uint64_t r; memcpy(&r,&x,8); return r; }\n"
+                   "#endif\n\n");
+        fprintf(f, "void %s(int64_t n, void* const ptr[]);\n"
+                   "void %s(int64_t n, void* const ptr[]) {\n"
+                   "    if (n <= 0) { return; }\n", name, name);
+        for (int loop_dependent = 0; loop_dependent < 2; loop_dependent++) {
+            if (loop_dependent) {
+                fprintf(f, "    for (int64_t i = 0; i < n; i++) {\n");
+            }
+            for (int i = 0; i < b->inst_len; i++) {
+                if (meta[i].live && meta[i].loop_dependent == loop_dependent) {
+                    emit_c_inst(f, b, i+1, loop_dependent ? "        " : "    ");
+                }
+            }
+        }
+        fprintf(f, "    }\n"
+                   "}\n\n");
+    }
+    free(meta);
+    return ok;
+}
+
+// Names, argument counts, output widths in bytes per lane, and rough cycles per N-lane chunk for
+// every portable stage, for weft_dump_builder() and weft_dump_program().  Costs are ballpark
+// figures for a modern out-of-order core, good for comparing kernels, not for predicting their
+// absolute speed.
+typedef struct { Stage* fn; const char* name; int args, bytes; double cost; } Op;
+#define OP(fn,args,bytes,cost) {fn, #fn, args, bytes, cost},
+
+#define INT_OPS(B,MUL)                                                                          \
+    OP(splat_##B, 0, B/8, 1) OP(uniform_##B, 0, B/8, 1) OP(load_##B, 0, B/8, 1)                 \
+    OP(load_strided_##B, 0, B/8, N)                                                             \
+    OP(store_##B, 1, 0, 1) OP(store_##B##_done, 1, 0, 1)                                        \
+    OP(assert_##B, 1, 0, 1) OP(if_any_##B, 1, 0, 1)                                             \
+    OP(store_masked_##B, 2, 0, 2) OP(store_masked_##B##_done, 2, 0, 2)                          \
+    OP(store_compress_##B, 2, 0, 4) OP(store_compress_##B##_done, 2, 0, 4)                      \
+    OP(count_compress_##B, 1, 0, 2)                                                             \
+    OP(scan_add_##B, 1, B/8, 4) OP(scan_max_u##B, 1, B/8, 4) OP(scan_max_s##B, 1, B/8, 4)       \
+    OP(not_##B, 1, B/8, 1) OP(shli_i##B, 1, B/8, 1)                                             \
+    OP(shri_s##B, 1, B/8, 1) OP(shri_u##B, 1, B/8, 1)                                           \
+    OP(shlv_i##B, 2, B/8, 1) OP(shrv_s##B, 2, B/8, 1) OP(shrv_u##B, 2, B/8, 1)                  \
+    OP(add_i##B, 2, B/8, 1) OP(sub_i##B, 2, B/8, 1) OP(mul_i##B, 2, B/8, MUL)                   \
+    OP(and_##B, 2, B/8, 1) OP(bic_##B, 2, B/8, 1) OP(or_##B, 2, B/8, 1) OP(xor_##B, 2, B/8, 1)  \
+    OP(sel_##B, 3, B/8, 1) OP(eq_i##B, 2, B/8, 1) OP(lt_s##B, 2, B/8, 1) OP(lt_u##B, 2, B/8, 1) \
+    OP(le_s##B, 2, B/8, 1) OP(le_u##B, 2, B/8, 1) OP(min_s##B, 2, B/8, 1)                       \
+    OP(min_u##B, 2, B/8, 1) OP(max_s##B, 2, B/8, 1) OP(max_u##B, 2, B/8, 1)                     \
+    OP(abs_s##B, 1, B/8, 1) OP(popcnt_##B, 1, B/8, 4) OP(clz_##B, 1, B/8, 4)                    \
+    OP(ctz_##B, 1, B/8, 4) OP(rotli_##B, 1, B/8, 2)                                             \
+    OP(rotlv_##B, 2, B/8, 2) OP(rotrv_##B, 2, B/8, 2)
+#define FLOAT_OPS(B,ALU,DIV,POLY)                                                               \
+    OP(cast_f##B, 1, B/8, ALU) OP(cast_s##B, 1, B/8, ALU) OP(ceil_f##B, 1, B/8, ALU)            \
+    OP(floor_f##B, 1, B/8, ALU) OP(round_f##B, 1, B/8, ALU) OP(cvt_nearest_f##B, 1, B/8, ALU)   \
+    OP(cvt_trunc_f##B, 1, B/8, ALU) OP(sqrt_f##B, 1, B/8, DIV) OP(add_f##B, 2, B/8, ALU)        \
+    OP(sub_f##B, 2, B/8, ALU) OP(mul_f##B, 2, B/8, ALU) OP(div_f##B, 2, B/8, DIV)               \
+    OP(eq_f##B, 2, B/8, ALU) OP(lt_f##B, 2, B/8, ALU) OP(le_f##B, 2, B/8, ALU)                  \
+    OP(min_f##B, 2, B/8, ALU) OP(max_f##B, 2, B/8, ALU) OP(abs_f##B, 1, B/8, ALU)               \
+    OP(exp_f##B, 1, B/8, POLY) OP(log_f##B, 1, B/8, POLY) OP(sin_f##B, 1, B/8, POLY)            \
+    OP(cos_f##B, 1, B/8, POLY) OP(pow_f##B, 2, B/8, 2*POLY)
+#define MUL_WIDE_OPS(B,W)                                                                       \
+    OP(mul_wide_s##B, 2, W/8, 2) OP(mul_wide_u##B, 2, W/8, 2)                                   \
+    OP(mulhi_s##B, 2, B/8, 2) OP(mulhi_u##B, 2, B/8, 2)
+
+// x86 variants and non-temporal stores aren't listed here; op() looks them up in best_stage()'s
+// and nontemporal_stage()'s tables and takes their arguments and widths from the portable stage.
+static const Op ops[] = {
+    OP(done, 0, 0, 0) OP(endif, 1, 0, 0)
+    INT_OPS( 8, 4)
+    INT_OPS(16, 1)
+    INT_OPS(32, 2)
+    INT_OPS(64, 4)
+    FLOAT_OPS(16, 4, 16, 40)
+    FLOAT_OPS(32, 1,  8, 20)
+    FLOAT_OPS(64, 2, 16, 40)
+    MUL_WIDE_OPS( 8,16)
+    MUL_WIDE_OPS(16,32)
+    MUL_WIDE_OPS(32,64)
+
+    OP(index_32, 0, 4, 1) OP(index_64, 0, 8, 1) OP(row_32, 0, 4, 1) OP(row_64, 0, 8, 1)
+    OP(histogram_add_32, 2, 0, 8) OP(histogram_add_32_done, 2, 0, 8)
+    OP(rcp_approx_f16, 1, 2, 4) OP(rsqrt_approx_f16, 1, 2, 4)
+    OP(rcp_approx_f32, 1, 4, 2) OP(rsqrt_approx_f32, 1, 4, 2)
+    OP(avg_u8, 2, 1, 1) OP(avg_u16, 2, 2, 1)
+    OP(narrow_i16, 1, 1, 1) OP(narrow_i32, 1, 2, 1) OP(narrow_i64, 1, 4, 1)
+    OP(narrow_f32, 1, 2, 2) OP(narrow_f64, 1, 4, 1)
+    OP(widen_s8, 1, 2, 1) OP(widen_s16, 1, 4, 1) OP(widen_s32, 1, 8, 1)
+    OP(widen_u8, 1, 2, 1) OP(widen_u16, 1, 4, 1) OP(widen_u32, 1, 8, 1)
+    OP(widen_f16, 1, 4, 2) OP(widen_f32, 1, 8, 1)
+    OP(dot_s16, 3, 4, 2) OP(dot_u8s8, 3, 4, 2)
+    OP(widen_bf16, 1, 4, 1) OP(narrow_bf16, 1, 2, 2)
+    OP(add_bf16, 2, 2, 4) OP(sub_bf16, 2, 2, 4) OP(mul_bf16, 2, 2, 4) OP(div_bf16, 2, 2, 12)
+    OP(table_16, 0, 2, 1) OP(lut16_8, 2, 1, 4) OP(table_32, 0, 4, 1) OP(lut32_8, 2, 1, 4)
+    OP(shuffle_16, 1, 2, 4) OP(shuffle_32, 1, 4, 4) OP(shuffle_64, 1, 8, 4)
+};
+
+static Op op(Stage* fn) {
+    for (int i = 0; i < (int)(sizeof ops / sizeof *ops); i++) {
+        if (fn == ops[i].fn) {
+            return ops[i];
+        }
+    }
+    const char* name = "?";
+    int cost = 0;
+    Stage* portable = portable_stage(fn, &name, &cost);
+    if (portable) {
+        Op o = op(portable);
+        o.fn   = fn;
+        o.name = name;
+        o.cost = cost ? cost : o.cost;
+        return o;
+    }
+    return (Op){fn, "?", 0, 0, 0};
+}
+
+static double stage_cost(Stage* fn) {
+    return op(fn).cost;
+}
+
+// Append an inst's arguments to line, as builder values vN or program scratch offsets [N], and its
+// immediate if it has one.  Insts with no arguments read from their immediate (splats, uniforms,
+// loads), so show it always.
+static int args(char* line, size_t size, bool program, Op o, int x, int y, int z, int64_t imm) {
+    int len = 0;
+    for (int i = 0, arg[] = {x,y,z}; i < o.args; i++) {
+        len += program ? snprintf(line+len, size - (size_t)len, " [%d]", arg[i])
+                       : snprintf(line+len, size - (size_t)len, " v%d" , arg[i]);
+    }
+    if (imm || o.args == 0) {
+        len += -65536 < imm && imm < 65536
+            ? snprintf(line+len, size - (size_t)len, " imm=%lld", (long long)imm)
+            : snprintf(line+len, size - (size_t)len, " imm=0x%llx", (unsigned long long)imm);
+    }
+    return len;
+}
+
+void weft_dump_builder(const Builder* b, FILE* f) {
+    struct { bool live, loop_dependent; } *meta = calloc((size_t)b->inst_len + 1, sizeof *meta);
+    for (int i = b->inst_len; i --> 0;) {
+        const BInst inst = b->inst[i];
+        meta[i].live |= inst.kind >= SIDE_EFFECT;
+        if (meta[i].live) {
+            if (inst.x) { meta[inst.x-1].live = true; }
+            if (inst.y) { meta[inst.y-1].live = true; }
+            if (inst.z) { meta[inst.z-1].live = true; }
+        }
+    }
+
+    int live = 0, invariant = 0;
+    double cost = 0;
+    for (int i = 0; i < b->inst_len; i++) {
+        const BInst inst = b->inst[i];
+        meta[i].loop_dependent = inst.kind >= LOAD
+                              || (inst.x && meta[inst.x-1].loop_dependent)
+                              || (inst.y && meta[inst.y-1].loop_dependent)
+                              || (inst.z && meta[inst.z-1].loop_dependent);
+        const Op o = op(inst.fn);
+        assert(o.bytes == inst.slots || inst.kind == SIDE_EFFECT);
+        assert(o.args == (inst.x != 0) + (inst.y != 0) + (inst.z != 0));
+
+        char line[128] = "";
+        char dst[16] = "";
+        if (inst.kind != SIDE_EFFECT) {
+            snprintf(dst, sizeof dst, "v%d =", i+1);
+        }
+        int len = snprintf(line, sizeof line, "%-7s %s", dst, o.name);
+        len += args(line+len, sizeof line - (size_t)len, false, o,
+                    inst.x, inst.y, inst.z, inst.imm);
+        fprintf(f, "%-48s", line);
+        fprintf(f, " ; %dB", inst.slots);
+        if (!meta[i].live) {
+            fprintf(f, ", dead");
+        } else if (!meta[i].loop_dependent) {
+            fprintf(f, ", invariant");
+            invariant++;
+        }
+        fprintf(f, "\n");
+
+        if (meta[i].live) {
+            live++;
+            cost += meta[i].loop_dependent ? op(best_stage(inst.fn)).cost : 0;
+        }
+    }
+    fprintf(f, "; %d insts, %d live, %d invariant, ~%.2f cycles per element\n",
+            b->inst_len, live, invariant, cost / N);
+    free(meta);
+}
+
+// Print p->inst[start,end) with the byte offsets each writes and reads in scratch,
+// returning the estimated cost of the insts from loop_inst on.
+static double dump_insts(const Program* p, FILE* f, const char* label,
+                         int start, int loop_inst, int end) {
+    double cost = 0;
+    fprintf(f, "%s:\n", label);
+    for (int i = start, r = 0; i < end; i++) {
+        if (i == loop_inst) {
+            fprintf(f, "loop:\n");
+        }
+        const PInst inst = p->inst[i];
+        const Op o = op(inst.fn);
+        char line[128] = "";
+        char dst[16] = "";
+        if (o.bytes) {
+            snprintf(dst, sizeof dst, "[%d] =", r);
+        }
+        int len = snprintf(line, sizeof line, "%-9s %s", dst, o.name);
+        len += args(line+len, sizeof line - (size_t)len, true, o,
+                    inst.x, inst.y, inst.z, inst.imm);
+        fprintf(f, "%4d  %-56s", i, line);
+        fprintf(f, " ; %dB, %g\n", o.bytes, o.cost);
+
+        r += N * o.bytes;
+        cost += i >= loop_inst ? o.cost : 0;
+    }
+    return cost;
+}
+
+void weft_dump_program(const Program* p, FILE* f) {
+    const int end = p->scan_inst ? p->scan_inst : p->state_inst;
+    const double cost = dump_insts(p, f, "program", 0, p->loop_inst, end);
+    if (p->scan_inst) {
+        dump_insts(p, f, "scan totals", p->scan_inst, p->scan_loop_inst, p->state_inst);
+    }
+    for (int k = 0; k < p->states; k++) {
+        fprintf(f, "state %d at [%d]: %s\n", k, N*p->slots + (int)sizeof(uint64_t) * k,
+                op(p->inst[p->state_inst + k].fn).name);
+    }
+    fprintf(f, "; %d insts, %d invariant, %d bytes of scratch, ~%.2f cycles per element\n",
+            end, p->loop_inst, N*p->slots + (int)sizeof(uint64_t) * p->states, cost / N);
+}
+
 static bool assign_reg(int reg[32], int frag, int* r) {
     for (int i = 0; i < 32; i++) {
         if (reg[i] == 0) {
@@ -792,6 +4023,8 @@ size_t weft_jit(const Builder* b, void* vbuf) {
     size_t len = 0;
 
     int reg[32] = {0};
+    char* open[8];
+    int depth = 0;
     {
         char* buf = vbuf ? vbuf : scratch;
         char* next = jit_setup(buf, reg);
@@ -846,6 +4079,16 @@ size_t weft_jit(const Builder* b, void* vbuf) {
         len += (size_t)(next - buf);
         vbuf = vbuf ? next : vbuf;
 
+        // Each if_any ends with a cbz we patch to branch here once we reach its endif.
+        if (is_if_any(inst.fn)) {
+            if (depth == (int)(sizeof open / sizeof *open)) { return 0; }
+            open[depth++] = next - 4;
+        }
+        if (inst.fn == endif) {
+            char* const cbz = open[--depth];
+            if (vbuf) { jit_patch_cbz(cbz, next); }
+        }
+
         // TODO: free up registers holding fragments of dead values.
     }
 
@@ -1,6 +1,7 @@
 #pragma once
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
 // General Weft usage and object lifetime:
 //
@@ -25,10 +26,81 @@ typedef struct weft_Program weft_Program;
 
 weft_Builder* weft_builder(void);
 weft_Program* weft_compile(weft_Builder*);
-void          weft_run    (const weft_Program*, int n, void* const ptr[]);
+void          weft_run    (const weft_Program*, int64_t n, void* const ptr[]);
+
+// Like weft_run(), but split n across up to the given number of threads.  Programs that use
+// weft_scan_*() or weft_store_compress_*() run in two passes: each thread first totals its share's
+// scans and counts the lanes it would store compressed, then runs its share for real starting
+// from the totals and counts of the threads before it.  Programs scanning the results of other
+// scans or storing compressed inside weft_if_any_*() just run on this thread.  Each thread counts
+// weft_histogram_add_32() into its own private histogram, merged into ptr[] once all threads
+// finish.
+void weft_run_parallel(const weft_Program*, int64_t n, void* const ptr[], int threads);
+
+// One weft_run(p, n, ptr) call for weft_run_batch().
+typedef struct {
+    const weft_Program* p;
+    void* const*        ptr;
+    int64_t             n;
+} weft_Job;
+
+// Run count jobs as if by weft_run(), sharing one scratch allocation per thread and grouping jobs
+// with the same weft_Program to run back to back, spread across up to the given number of threads.
+// A job with the same program and the same pointers to uniforms as the one before it skips the
+// invariant prefix.  Jobs may run in any order and concurrently, so they must not depend on each
+// other's writes.
+void weft_run_batch(const weft_Job*, int count, int threads);
+
+// Run width instances on each of height rows, with each row's ptr[i] advanced by
+// row_stride_bytes[i] from the last; use a stride of 0 for uniforms and other shared pointers.
+// The invariant prefix runs once per thread rather than once per row, and weft_row_*() gives the
+// row index.  Blocks of rows split across up to the given number of threads, except for programs
+// using scans, histograms or weft_store_compress_*(), which carry across rows in order on this
+// thread.
+void weft_run_2d(const weft_Program*, int64_t width, int64_t height,
+                 void* const ptr[], const int64_t row_stride_bytes[], int threads);
+
+// Run a weft_Program over input that arrives a piece at a time, as if by one weft_run() over all
+// of it.  Each weft_stream_push() runs its whole chunks right away and holds its last few
+// instances back, running them in a full chunk once later pushes fill it out, so only the very
+// last chunk at weft_stream_flush() takes the slower partial path.  Scans and histograms carry
+// across pushes.  Held-back instances' loads are copied right away, but their stores land later,
+// so memory a push stores to must stay valid until the next push or flush.  weft_index_*()
+// restarts at 0 with each run and is not meaningful here.  weft_stream_flush() also frees the
+// weft_Stream.
+typedef struct weft_Stream weft_Stream;
+weft_Stream* weft_stream_open (const weft_Program*);
+void         weft_stream_push (weft_Stream*, int64_t n, void* const ptr[]);
+void         weft_stream_flush(weft_Stream*);
+
+// Like weft_run_parallel(), but ptr[i] is the file at path[i] mapped into memory, wherever path[i]
+// is not NULL.  Files only read are mapped read-only, and files both read and stored to are
+// updated in place; either must already hold at least n instances' worth.  Files only stored to
+// are created or resized to exactly n instances' worth.  Paths are only for pointers loaded or
+// stored with one fixed, positive number of bytes per instance.  Each thread works through its
+// share in windows of about 1MB, asking the OS to read ahead of the window it is on.  Scans,
+// histograms and weft_store_compress_*() split across threads just as in weft_run_parallel(),
+// with scans and compressing stores making a first pass over the files.  Returns 0 if a file
+// could not be opened, sized or mapped, or on platforms without mmap(), 1 otherwise.
+int weft_run_files(const weft_Program*, int64_t n, void* const ptr[], const char* const path[],
+                   int threads);
 
 size_t weft_jit(const weft_Builder*, void*);
 
+// Write C source for a standalone function `void name(int64_t n, void* const ptr[])` that does
+// what weft_run() would with this weft_Builder's program, as one fused loop over n.  Returns 0
+// and writes nothing if the program uses an op with no C equivalent here, e.g. f16 math,
+// transcendentals, shuffles, weft_if_any_*() regions, scans and histograms.
+int weft_emit_c(const weft_Builder*, const char* name, FILE*);
+
+// Print a listing of a weft_Builder's values or a weft_Program's instructions, for tuning.
+// Builder values are marked dead if nothing uses them and invariant if weft_compile() will hoist
+// them out of the loop.  Program instructions show the scratch byte offsets they write and read,
+// the loop they run in, and the variant picked for this CPU.  Each listing ends with a rough
+// estimate of the loop's cycles per element.
+void weft_dump_builder(const weft_Builder*, FILE*);
+void weft_dump_program(const weft_Program*, FILE*);
+
 typedef struct { int id; } weft_V8;
 typedef struct { int id; } weft_V16;
 typedef struct { int id; } weft_V32;
@@ -52,18 +124,93 @@ weft_V16 weft_load_16(weft_Builder*, int ptr);
 weft_V32 weft_load_32(weft_Builder*, int ptr);
 weft_V64 weft_load_64(weft_Builder*, int ptr);
 
+// Load lane i from byte i*stride_bytes of the given pointer, e.g. one field of an array of structs.
+// stride_bytes may be negative to walk an array backward.
+weft_V8  weft_load_strided_8 (weft_Builder*, int ptr, int stride_bytes);
+weft_V16 weft_load_strided_16(weft_Builder*, int ptr, int stride_bytes);
+weft_V32 weft_load_strided_32(weft_Builder*, int ptr, int stride_bytes);
+weft_V64 weft_load_strided_64(weft_Builder*, int ptr, int stride_bytes);
+
+// Runs loading more than about 1MB prefetch each pointer loaded by weft_load_*() or
+// weft_load_strided_*() n instances ahead, counting runs as weft_nontemporal_stores() does.  By
+// default n is picked to cover memory latency at the program's estimated cost per instance, as
+// weft_dump_program() reports it.  Pass 0 to return to the default or a negative n to never
+// prefetch.
+void weft_prefetch_distance(weft_Builder*, int64_t n);
+
+// Each lane's index i into the loop, the values weft_load_*() would read from {0,1,2,...,n-1}.
+// weft_index_32() keeps only the low 32 bits of i.
+weft_V32 weft_index_32(weft_Builder*);
+weft_V64 weft_index_64(weft_Builder*);
+
+// Each lane's row under weft_run_2d(), or 0 under weft_run() and the rest.
+weft_V32 weft_row_32(weft_Builder*);
+weft_V64 weft_row_64(weft_Builder*);
+
+// Inclusive prefix scans across instances: each lane gets the sum or max of x over its own and
+// every earlier instance in this weft_run().  Sums wrap on overflow.  Scans must be built outside
+// any weft_if_any_*() region.
+weft_V8  weft_scan_add_8 (weft_Builder*, weft_V8 );
+weft_V16 weft_scan_add_16(weft_Builder*, weft_V16);
+weft_V32 weft_scan_add_32(weft_Builder*, weft_V32);
+weft_V64 weft_scan_add_64(weft_Builder*, weft_V64);
+weft_V8  weft_scan_max_s8 (weft_Builder*, weft_V8 );
+weft_V8  weft_scan_max_u8 (weft_Builder*, weft_V8 );
+weft_V16 weft_scan_max_s16(weft_Builder*, weft_V16);
+weft_V16 weft_scan_max_u16(weft_Builder*, weft_V16);
+weft_V32 weft_scan_max_s32(weft_Builder*, weft_V32);
+weft_V32 weft_scan_max_u32(weft_Builder*, weft_V32);
+weft_V64 weft_scan_max_s64(weft_Builder*, weft_V64);
+weft_V64 weft_scan_max_u64(weft_Builder*, weft_V64);
+
 // Store a value's lanes contiguously to the given pointer.
 void weft_store_8 (weft_Builder*, int ptr, weft_V8 );
 void weft_store_16(weft_Builder*, int ptr, weft_V16);
 void weft_store_32(weft_Builder*, int ptr, weft_V32);
 void weft_store_64(weft_Builder*, int ptr, weft_V64);
 
+// Runs of at least n instances write weft_store_*() results with non-temporal stores where the
+// CPU has them, keeping large outputs from evicting everything else in cache.  By default that's
+// any run storing more than about 32MB.  weft_run_parallel() and friends count each thread's
+// share as a run, however they split it up, and a stream counts each push.  Pass 0 to return to
+// the default or INT64_MAX to never use them.
+void weft_nontemporal_stores(weft_Builder*, int64_t n);
+
+// Store x's lanes where mask is true, leaving memory for the other lanes untouched.
+void weft_store_masked_8 (weft_Builder*, int ptr, weft_V8  mask, weft_V8  x);
+void weft_store_masked_16(weft_Builder*, int ptr, weft_V16 mask, weft_V16 x);
+void weft_store_masked_32(weft_Builder*, int ptr, weft_V32 mask, weft_V32 x);
+void weft_store_masked_64(weft_Builder*, int ptr, weft_V64 mask, weft_V64 x);
+
+// Store only x's lanes where mask is true, packed contiguously starting at element *count_ptr
+// (an int64_t) of ptr, and advance *count_ptr past them.  Start *count_ptr at 0; to split n
+// across several weft_run() calls, give each its own output and count, then concatenate, or let
+// weft_run_parallel() do that.
+void weft_store_compress_8 (weft_Builder*, int ptr, int count_ptr, weft_V8  mask, weft_V8  x);
+void weft_store_compress_16(weft_Builder*, int ptr, int count_ptr, weft_V16 mask, weft_V16 x);
+void weft_store_compress_32(weft_Builder*, int ptr, int count_ptr, weft_V32 mask, weft_V32 x);
+void weft_store_compress_64(weft_Builder*, int ptr, int count_ptr, weft_V64 mask, weft_V64 x);
+
+// Add each lane's weight to element bucket of the uint32_t histogram at ptr, wrapping on overflow.
+// Lanes hitting the same bucket each count.
+void weft_histogram_add_32(weft_Builder*, int ptr, weft_V32 bucket, weft_V32 weight);
+
 // assert() all a value's lanes are true.
 void weft_assert_8 (weft_Builder*, weft_V8);
 void weft_assert_16(weft_Builder*, weft_V16);
 void weft_assert_32(weft_Builder*, weft_V32);
 void weft_assert_64(weft_Builder*, weft_V64);
 
+// Run the insts built between weft_if_any_*() and the matching weft_endif() only when some lane
+// of mask is true, skipping them for chunks where none is.  Values built inside may not be used
+// after weft_endif(), and stores inside write all of a chunk's lanes or none, so store something
+// like sel(mask, new, old).  Regions nest.
+void weft_if_any_8 (weft_Builder*, weft_V8  mask);
+void weft_if_any_16(weft_Builder*, weft_V16 mask);
+void weft_if_any_32(weft_Builder*, weft_V32 mask);
+void weft_if_any_64(weft_Builder*, weft_V64 mask);
+void weft_endif    (weft_Builder*);
+
 // Arithmetic.
 weft_V8 weft_add_i8(weft_Builder*, weft_V8, weft_V8);
 weft_V8 weft_sub_i8(weft_Builder*, weft_V8, weft_V8);
@@ -93,6 +240,57 @@ weft_V64 weft_shl_i64(weft_Builder*, weft_V64, weft_V64);
 weft_V64 weft_shr_s64(weft_Builder*, weft_V64, weft_V64);
 weft_V64 weft_shr_u64(weft_Builder*, weft_V64, weft_V64);
 
+weft_V8 weft_min_s8(weft_Builder*, weft_V8, weft_V8);
+weft_V8 weft_min_u8(weft_Builder*, weft_V8, weft_V8);
+weft_V8 weft_max_s8(weft_Builder*, weft_V8, weft_V8);
+weft_V8 weft_max_u8(weft_Builder*, weft_V8, weft_V8);
+weft_V8 weft_abs_s8(weft_Builder*, weft_V8);
+weft_V8 weft_avg_u8(weft_Builder*, weft_V8, weft_V8);
+
+weft_V16 weft_min_s16(weft_Builder*, weft_V16, weft_V16);
+weft_V16 weft_min_u16(weft_Builder*, weft_V16, weft_V16);
+weft_V16 weft_max_s16(weft_Builder*, weft_V16, weft_V16);
+weft_V16 weft_max_u16(weft_Builder*, weft_V16, weft_V16);
+weft_V16 weft_abs_s16(weft_Builder*, weft_V16);
+weft_V16 weft_avg_u16(weft_Builder*, weft_V16, weft_V16);
+
+weft_V32 weft_min_s32(weft_Builder*, weft_V32, weft_V32);
+weft_V32 weft_min_u32(weft_Builder*, weft_V32, weft_V32);
+weft_V32 weft_max_s32(weft_Builder*, weft_V32, weft_V32);
+weft_V32 weft_max_u32(weft_Builder*, weft_V32, weft_V32);
+weft_V32 weft_abs_s32(weft_Builder*, weft_V32);
+
+weft_V64 weft_min_s64(weft_Builder*, weft_V64, weft_V64);
+weft_V64 weft_min_u64(weft_Builder*, weft_V64, weft_V64);
+weft_V64 weft_max_s64(weft_Builder*, weft_V64, weft_V64);
+weft_V64 weft_max_u64(weft_Builder*, weft_V64, weft_V64);
+weft_V64 weft_abs_s64(weft_Builder*, weft_V64);
+
+// Bit counts, with clz and ctz of 0 giving the lane width, and rotates by y mod the lane width.
+weft_V8 weft_popcnt_8(weft_Builder*, weft_V8);
+weft_V8 weft_clz_8   (weft_Builder*, weft_V8);
+weft_V8 weft_ctz_8   (weft_Builder*, weft_V8);
+weft_V8 weft_rotl_8  (weft_Builder*, weft_V8, weft_V8);
+weft_V8 weft_rotr_8  (weft_Builder*, weft_V8, weft_V8);
+
+weft_V16 weft_popcnt_16(weft_Builder*, weft_V16);
+weft_V16 weft_clz_16   (weft_Builder*, weft_V16);
+weft_V16 weft_ctz_16   (weft_Builder*, weft_V16);
+weft_V16 weft_rotl_16  (weft_Builder*, weft_V16, weft_V16);
+weft_V16 weft_rotr_16  (weft_Builder*, weft_V16, weft_V16);
+
+weft_V32 weft_popcnt_32(weft_Builder*, weft_V32);
+weft_V32 weft_clz_32   (weft_Builder*, weft_V32);
+weft_V32 weft_ctz_32   (weft_Builder*, weft_V32);
+weft_V32 weft_rotl_32  (weft_Builder*, weft_V32, weft_V32);
+weft_V32 weft_rotr_32  (weft_Builder*, weft_V32, weft_V32);
+
+weft_V64 weft_popcnt_64(weft_Builder*, weft_V64);
+weft_V64 weft_clz_64   (weft_Builder*, weft_V64);
+weft_V64 weft_ctz_64   (weft_Builder*, weft_V64);
+weft_V64 weft_rotl_64  (weft_Builder*, weft_V64, weft_V64);
+weft_V64 weft_rotr_64  (weft_Builder*, weft_V64, weft_V64);
+
 weft_V8 weft_and_8(weft_Builder*, weft_V8, weft_V8);
 weft_V8 weft_or_8 (weft_Builder*, weft_V8, weft_V8);
 weft_V8 weft_xor_8(weft_Builder*, weft_V8, weft_V8);
@@ -130,16 +328,67 @@ weft_V64 weft_div_f64(weft_Builder*, weft_V64, weft_V64);
 
 weft_V16 weft_ceil_f16 (weft_Builder*, weft_V16);
 weft_V16 weft_floor_f16(weft_Builder*, weft_V16);
+weft_V16 weft_round_f16(weft_Builder*, weft_V16);  // Ties to even.
 weft_V16 weft_sqrt_f16 (weft_Builder*, weft_V16);
 
 weft_V32 weft_ceil_f32 (weft_Builder*, weft_V32);
 weft_V32 weft_floor_f32(weft_Builder*, weft_V32);
+weft_V32 weft_round_f32(weft_Builder*, weft_V32);  // Ties to even.
 weft_V32 weft_sqrt_f32 (weft_Builder*, weft_V32);
 
 weft_V64 weft_ceil_f64 (weft_Builder*, weft_V64);
 weft_V64 weft_floor_f64(weft_Builder*, weft_V64);
+weft_V64 weft_round_f64(weft_Builder*, weft_V64);  // Ties to even.
 weft_V64 weft_sqrt_f64 (weft_Builder*, weft_V64);
 
+// Polynomial approximations, within these errors of the true result:
+//    exp:      1 ulp
+//    log:      2 ulp
+//    sin, cos: 1 ulp for f16 and f32, 2 ulp for f64, for |x| < 2^19; range reduction loses
+//              precision beyond that
+//    pow:      1 ulp for f16 and f32, 2 ulp for f64
+// pow() is defined only for x >= 0, returning NaN for negative x even when y is an integer.
+weft_V16 weft_exp_f16(weft_Builder*, weft_V16);
+weft_V16 weft_log_f16(weft_Builder*, weft_V16);
+weft_V16 weft_sin_f16(weft_Builder*, weft_V16);
+weft_V16 weft_cos_f16(weft_Builder*, weft_V16);
+weft_V16 weft_pow_f16(weft_Builder*, weft_V16, weft_V16);
+
+weft_V32 weft_exp_f32(weft_Builder*, weft_V32);
+weft_V32 weft_log_f32(weft_Builder*, weft_V32);
+weft_V32 weft_sin_f32(weft_Builder*, weft_V32);
+weft_V32 weft_cos_f32(weft_Builder*, weft_V32);
+weft_V32 weft_pow_f32(weft_Builder*, weft_V32, weft_V32);
+
+weft_V64 weft_exp_f64(weft_Builder*, weft_V64);
+weft_V64 weft_log_f64(weft_Builder*, weft_V64);
+weft_V64 weft_sin_f64(weft_Builder*, weft_V64);
+weft_V64 weft_cos_f64(weft_Builder*, weft_V64);
+weft_V64 weft_pow_f64(weft_Builder*, weft_V64, weft_V64);
+
+// Hardware estimates of 1/x and 1/sqrt(x) (rcpps/rsqrtps, frecpe/frsqrte), each followed by
+// steps rounds of Newton-Raphson refinement.  The estimate's relative error is at most 2^-8,
+// and each step roughly squares it: 2^-15 after one step, 2^-22 after two.  Zero, infinite
+// and NaN results are left as estimated; denormal x may be treated as zero.
+weft_V16 weft_rcp_approx_f16  (weft_Builder*, weft_V16, int steps);
+weft_V16 weft_rsqrt_approx_f16(weft_Builder*, weft_V16, int steps);
+
+weft_V32 weft_rcp_approx_f32  (weft_Builder*, weft_V32, int steps);
+weft_V32 weft_rsqrt_approx_f32(weft_Builder*, weft_V32, int steps);
+
+// Float min/max follow fmin()/fmax(): when one argument is NaN, the other is returned.
+weft_V16 weft_min_f16(weft_Builder*, weft_V16, weft_V16);
+weft_V16 weft_max_f16(weft_Builder*, weft_V16, weft_V16);
+weft_V16 weft_abs_f16(weft_Builder*, weft_V16);
+
+weft_V32 weft_min_f32(weft_Builder*, weft_V32, weft_V32);
+weft_V32 weft_max_f32(weft_Builder*, weft_V32, weft_V32);
+weft_V32 weft_abs_f32(weft_Builder*, weft_V32);
+
+weft_V64 weft_min_f64(weft_Builder*, weft_V64, weft_V64);
+weft_V64 weft_max_f64(weft_Builder*, weft_V64, weft_V64);
+weft_V64 weft_abs_f64(weft_Builder*, weft_V64);
+
 weft_V8  weft_narrow_i16(weft_Builder*, weft_V16);
 weft_V16 weft_narrow_i32(weft_Builder*, weft_V32);
 weft_V32 weft_narrow_i64(weft_Builder*, weft_V64);
@@ -155,6 +404,38 @@ weft_V64 weft_widen_u32(weft_Builder*, weft_V32);
 weft_V32 weft_widen_f16(weft_Builder*, weft_V16);
 weft_V64 weft_widen_f32(weft_Builder*, weft_V32);
 
+// Widening multiplies return the full product; mulhi returns its high half.
+weft_V16 weft_mul_wide_s8 (weft_Builder*, weft_V8 , weft_V8 );
+weft_V16 weft_mul_wide_u8 (weft_Builder*, weft_V8 , weft_V8 );
+weft_V32 weft_mul_wide_s16(weft_Builder*, weft_V16, weft_V16);
+weft_V32 weft_mul_wide_u16(weft_Builder*, weft_V16, weft_V16);
+weft_V64 weft_mul_wide_s32(weft_Builder*, weft_V32, weft_V32);
+weft_V64 weft_mul_wide_u32(weft_Builder*, weft_V32, weft_V32);
+
+weft_V8  weft_mulhi_s8 (weft_Builder*, weft_V8 , weft_V8 );
+weft_V8  weft_mulhi_u8 (weft_Builder*, weft_V8 , weft_V8 );
+weft_V16 weft_mulhi_s16(weft_Builder*, weft_V16, weft_V16);
+weft_V16 weft_mulhi_u16(weft_Builder*, weft_V16, weft_V16);
+weft_V32 weft_mulhi_s32(weft_Builder*, weft_V32, weft_V32);
+weft_V32 weft_mulhi_u32(weft_Builder*, weft_V32, weft_V32);
+
+// Dot products see each 32-bit lane of x and y as two s16, or as four u8 in x and four s8 in y,
+// and add the sum of their pairwise products to acc, wrapping on overflow like pmaddwd and
+// vpdpbusd.  Load int16 or int8 data with weft_load_32() to feed them.
+weft_V32 weft_dot_s16 (weft_Builder*, weft_V32 x, weft_V32 y, weft_V32 acc);
+weft_V32 weft_dot_u8s8(weft_Builder*, weft_V32 x, weft_V32 y, weft_V32 acc);
+
+// bfloat16 values are the top 16 bits of an f32.  Widening is exact; narrowing rounds to
+// nearest-even, quiets NaNs and flushes denormals to zero, matching vcvtneps2bf16.
+// bf16 arithmetic widens to f32, operates there, and narrows the result.
+weft_V32 weft_widen_bf16 (weft_Builder*, weft_V16);
+weft_V16 weft_narrow_bf16(weft_Builder*, weft_V32);
+
+weft_V16 weft_add_bf16(weft_Builder*, weft_V16, weft_V16);
+weft_V16 weft_sub_bf16(weft_Builder*, weft_V16, weft_V16);
+weft_V16 weft_mul_bf16(weft_Builder*, weft_V16, weft_V16);
+weft_V16 weft_div_bf16(weft_Builder*, weft_V16, weft_V16);
+
 weft_V16 weft_cast_f16(weft_Builder*, weft_V16);
 weft_V32 weft_cast_f32(weft_Builder*, weft_V32);
 weft_V64 weft_cast_f64(weft_Builder*, weft_V64);
@@ -163,6 +444,33 @@ weft_V16 weft_cast_s16(weft_Builder*, weft_V16);
 weft_V32 weft_cast_s32(weft_Builder*, weft_V32);
 weft_V64 weft_cast_s64(weft_Builder*, weft_V64);
 
+// Float to int conversions rounding to nearest-even or toward zero.  Unlike weft_cast_f*(),
+// out-of-range values saturate to the integer's limits and NaN converts to 0, like fcvtns/fcvtzs.
+weft_V16 weft_cvt_nearest_f16(weft_Builder*, weft_V16);
+weft_V32 weft_cvt_nearest_f32(weft_Builder*, weft_V32);
+weft_V64 weft_cvt_nearest_f64(weft_Builder*, weft_V64);
+
+weft_V16 weft_cvt_trunc_f16(weft_Builder*, weft_V16);
+weft_V32 weft_cvt_trunc_f32(weft_Builder*, weft_V32);
+weft_V64 weft_cvt_trunc_f64(weft_Builder*, weft_V64);
+
+// Look up each of idx's lanes in a 16-byte table, producing 0 for idx >= 16.
+weft_V8 weft_lut16_8(weft_Builder*, int table_ptr, weft_V8 idx);
+
+// Look up each of idx's lanes in a 32-byte table, producing 0 for idx >= 32.
+weft_V8 weft_lut32_8(weft_Builder*, int table_ptr, weft_V8 idx);
+
+// Rearrange the bytes within each lane.  Byte k of control (bits 8k to 8k+7) picks which byte of
+// x's lane goes to byte k of the result's, with any value past the end of the lane producing 0.
+weft_V16 weft_shuffle_16(weft_Builder*, weft_V16 x, uint16_t control);
+weft_V32 weft_shuffle_32(weft_Builder*, weft_V32 x, uint32_t control);
+weft_V64 weft_shuffle_64(weft_Builder*, weft_V64 x, uint64_t control);
+
+// Reverse the order of bytes in each lane.
+weft_V16 weft_bswap_16(weft_Builder*, weft_V16);
+weft_V32 weft_bswap_32(weft_Builder*, weft_V32);
+weft_V64 weft_bswap_64(weft_Builder*, weft_V64);
+
 weft_V8  weft_not_8 (weft_Builder*, weft_V8);
 weft_V16 weft_not_16(weft_Builder*, weft_V16);
 weft_V32 weft_not_32(weft_Builder*, weft_V32);